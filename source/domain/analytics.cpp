@@ -0,0 +1,157 @@
+#include "analytics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+void append(std::string& buffer, const std::vector<T>& values) {
+  buffer.append(reinterpret_cast<const char*>(values.data()),
+                values.size() * sizeof(T));
+}
+
+template <typename T>
+void extract(const std::string& buffer, size_t& offset, std::vector<T>& values,
+             size_t count) {
+  if (count > (buffer.size() - offset) / sizeof(T)) {
+    throw std::runtime_error("Malformed analytics");
+  }
+  values.resize(count);
+  std::memcpy(values.data(), buffer.data() + offset, count * sizeof(T));
+  offset += count * sizeof(T);
+}
+
+}  // namespace
+
+void Analytics::reset(const AnswerKeys& keys) {
+  _stages.assign(keys.stages.begin(), keys.stages.end());
+  _questions.resize(keys.answers.size());
+  std::transform(keys.answers.begin(), keys.answers.end(), _questions.begin(),
+                 [](const Answer& answer) { return answer.qst_idx; });
+  _stage_values.assign(_stages.size() * STAGE_FIELDS, 0.0);
+  _question_values.assign(_questions.size() * 2, 0);
+}
+
+void Analytics::add_exam(size_t stage_index, f64 score, f64 max_score) {
+  auto* row = _stage_values.data() + stage_index * STAGE_FIELDS;
+  row[0] += 1.0;
+  row[1] += score;
+  row[2] += score * score;
+  size_t bin = 0;
+  if (max_score > 0.0 && score > 0.0) {
+    bin = std::min(static_cast<size_t>(score / max_score * SCORE_BINS),
+                   SCORE_BINS - 1);
+  }
+  row[3 + bin] += 1.0;
+}
+
+std::span<i64> Analytics::questions(size_t stage_index) {
+  const auto& entry = _stages[stage_index];
+  return std::span<i64>(_question_values)
+      .subspan(size_t{entry.offset} * 2, size_t{entry.size} * 2);
+}
+
+void Analytics::reduce(MPI_Comm comm, i32 root) {
+  i32 rank = 0;
+  MPI_Comm_rank(comm, &rank);
+  const bool is_root = rank == root;
+  auto reduce_result = MPI_Reduce(
+      is_root ? MPI_IN_PLACE : _stage_values.data(), _stage_values.data(),
+      static_cast<i32>(_stage_values.size()), MPI_DOUBLE, MPI_SUM, root, comm);
+  if (reduce_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to reduce stage analytics");
+  }
+  reduce_result = MPI_Reduce(
+      is_root ? MPI_IN_PLACE : _question_values.data(),
+      _question_values.data(), static_cast<i32>(_question_values.size()),
+      MPI_INT64_T, MPI_SUM, root, comm);
+  if (reduce_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to reduce question analytics");
+  }
+}
+
+void Analytics::merge(const Analytics& other) {
+  for (size_t j = 0; j < other._stages.size(); j++) {
+    const auto& entry = other._stages[j];
+    auto it = std::lower_bound(_stages.begin(), _stages.end(), entry.stage,
+                               [](const AnswerKeyEntry& e, i32 value) {
+                                 return e.stage < value;
+                               });
+    if (it == _stages.end() || it->stage != entry.stage ||
+        it->size != entry.size) {
+      continue;
+    }
+    auto i = static_cast<size_t>(it - _stages.begin());
+    for (size_t field = 0; field < STAGE_FIELDS; field++) {
+      _stage_values[i * STAGE_FIELDS + field] +=
+          other._stage_values[j * STAGE_FIELDS + field];
+    }
+    for (size_t k = 0; k < size_t{entry.size} * 2; k++) {
+      _question_values[size_t{it->offset} * 2 + k] +=
+          other._question_values[size_t{entry.offset} * 2 + k];
+    }
+  }
+}
+
+void Analytics::pack(std::string& buffer) const {
+  buffer.clear();
+  u64 counts[] = {_stages.size(), _questions.size()};
+  buffer.append(reinterpret_cast<const char*>(counts), sizeof(counts));
+  append(buffer, _stages);
+  append(buffer, _questions);
+  append(buffer, _stage_values);
+  append(buffer, _question_values);
+}
+
+void Analytics::unpack(const std::string& buffer) {
+  u64 counts[2];
+  if (buffer.size() < sizeof(counts)) {
+    throw std::runtime_error("Malformed analytics");
+  }
+  std::memcpy(counts, buffer.data(), sizeof(counts));
+  size_t offset = sizeof(counts);
+  extract(buffer, offset, _stages, counts[0]);
+  extract(buffer, offset, _questions, counts[1]);
+  extract(buffer, offset, _stage_values, counts[0] * STAGE_FIELDS);
+  extract(buffer, offset, _question_values, counts[1] * 2);
+  for (const auto& entry : _stages) {
+    if (size_t{entry.offset} + entry.size > _questions.size()) {
+      throw std::runtime_error("Malformed analytics");
+    }
+  }
+}
+
+json Analytics::to_json() const {
+  json stages = json::array();
+  for (size_t i = 0; i < _stages.size(); i++) {
+    const auto& entry = _stages[i];
+    const auto* row = _stage_values.data() + i * STAGE_FIELDS;
+    auto exams = row[0];
+    auto mean = exams > 0.0 ? row[1] / exams : 0.0;
+    auto variance = exams > 0.0 ? row[2] / exams - mean * mean : 0.0;
+    json histogram = json::array();
+    for (size_t bin = 0; bin < SCORE_BINS; bin++) {
+      histogram.push_back(static_cast<i64>(row[3 + bin]));
+    }
+    json questions = json::array();
+    for (size_t k = entry.offset; k < size_t{entry.offset} + entry.size; k++) {
+      auto answered = _question_values[2 * k];
+      auto correct = _question_values[2 * k + 1];
+      questions.push_back(
+          {{"qst_idx", _questions[k]},
+           {"answered", answered},
+           {"correct", correct},
+           {"correct_rate",
+            exams > 0.0 ? static_cast<f64>(correct) / exams : 0.0}});
+    }
+    stages.push_back({{"stage", entry.stage},
+                      {"exams", static_cast<i64>(exams)},
+                      {"mean", mean},
+                      {"stddev", std::sqrt(std::max(variance, 0.0))},
+                      {"histogram", histogram},
+                      {"questions", questions}});
+  }
+  return json{{"stages", stages}};
+}
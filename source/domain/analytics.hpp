@@ -0,0 +1,73 @@
+#pragma once
+#ifndef ANALYTICS_HPP
+#define ANALYTICS_HPP
+
+#include <mpi.h>
+#include <domain/answers.hpp>
+#include <nlohmann/json.hpp>
+#include <span>
+#include <string>
+#include <system/aliases.hpp>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * @brief Per-stage and per-question aggregates of scored exams
+ * @details Laid out after the answer keys the exams were scored with: one row
+ *          of STAGE_FIELDS doubles per key stage (exams, score sum, squared
+ *          score sum, score histogram) and a pair of counters (answered,
+ *          correct) per key answer. Ranks scoring with the same keys, e.g. the
+ *          ranks of a node, share the layout and combine with reduce();
+ *          partials scored with different keys are folded by stage with
+ *          merge().
+ */
+class Analytics {
+ public:
+  static constexpr size_t SCORE_BINS = 10; /** Histogram over [0, max] */
+  static constexpr size_t STAGE_FIELDS = 3 + SCORE_BINS;
+
+  /**
+   * @brief Drop every aggregate and lay the tables out after `keys`
+   */
+  void reset(const AnswerKeys& keys);
+
+  /**
+   * @brief Record the score of one exam
+   * @param stage_index Position of the exam stage in the answer keys
+   * @param score Score of the exam
+   * @param max_score Best possible score of the stage
+   */
+  void add_exam(size_t stage_index, f64 score, f64 max_score);
+
+  /**
+   * @brief Answered and correct counters of the questions of a stage
+   * @return Two counters per key answer of the stage, in key order
+   */
+  std::span<i64> questions(size_t stage_index);
+
+  /**
+   * @brief Sum the aggregates of every rank of `comm` into `root`
+   * @details Collective over `comm`, every rank must use the same keys.
+   */
+  void reduce(MPI_Comm comm, i32 root);
+
+  /**
+   * @brief Add the aggregates of another partial, stage by stage
+   * @details Stages unknown here, or whose key has a different size, are
+   *          ignored.
+   */
+  void merge(const Analytics& other);
+
+  void pack(std::string& buffer) const;
+  void unpack(const std::string& buffer);
+  json to_json() const;
+
+ private:
+  std::vector<AnswerKeyEntry> _stages;
+  std::vector<i32> _questions;        /** qst_idx of every key answer */
+  std::vector<f64> _stage_values;     /** STAGE_FIELDS per stage */
+  std::vector<i64> _question_values;  /** answered, correct per key answer */
+};
+
+#endif  // ANALYTICS_HPP
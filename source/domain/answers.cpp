@@ -1,62 +1,324 @@
 #include "answers.hpp"
 #include <spdlog/spdlog.h>
+#include <algorithm>
 #include <mutex>
+#include <stdexcept>
 
 std::unique_ptr<AnswersManager> AnswersManager::_instance = nullptr;
 
+AnswersManager::AnswersManager()
+    : _current(std::make_shared<const AnswersSnapshot>()) {}
+
 AnswersManager& AnswersManager::instance() {
   static std::once_flag flag;
   std::call_once(flag, []() { _instance.reset(new AnswersManager()); });
   return *_instance;
 }
 
+u32 options_mask(const json& options) {
+  u32 mask = 0;
+  for (const auto& option : options) {
+    auto index = option.get<i32>();
+    if (index < 1 || index > MAX_OPTIONS) {
+      throw std::runtime_error("Invalid multi-select option");
+    }
+    mask |= 1u << (index - 1);
+  }
+  return mask;
+}
+
+json mask_options(u32 mask) {
+  json options = json::array();
+  for (i32 index = 1; index <= MAX_OPTIONS; index++) {
+    if (mask & (1u << (index - 1))) {
+      options.push_back(index);
+    }
+  }
+  return options;
+}
+
+void to_json(json& j, const Answer& answer) {
+  j = json{{"qst_idx", answer.qst_idx}};
+  if (answer.rans_mask != 0) {
+    j["rans_idx"] = mask_options(answer.rans_mask);
+  } else {
+    j["rans_idx"] = answer.rans_idx;
+  }
+}
+
+void from_json(const json& j, Answer& answer) {
+  j.at("qst_idx").get_to(answer.qst_idx);
+  const auto& rans_idx = j.at("rans_idx");
+  if (rans_idx.is_array()) {
+    answer.rans_idx = 0;
+    answer.rans_mask = options_mask(rans_idx);
+    if (answer.rans_mask == 0) {
+      throw std::runtime_error("Empty multi-select answer");
+    }
+  } else {
+    rans_idx.get_to(answer.rans_idx);
+    answer.rans_mask = 0;
+  }
+}
+
+void to_json(json& j, const ExamAnswers& exam_answers) {
+  json answers = json::array();
+  for (size_t i = 0; i < exam_answers.answers.size(); i++) {
+    json answer = exam_answers.answers[i];
+    if (!exam_answers.weights.empty()) {
+      answer["weight"] = exam_answers.weights[i];
+    }
+    answers.push_back(answer);
+  }
+  j = json{{"stage", exam_answers.stage}, {"answers", answers}};
+  const auto& scoring = exam_answers.scoring;
+  StageScoring defaults;
+  if (scoring.correct != defaults.correct || scoring.wrong != defaults.wrong ||
+      scoring.blank != defaults.blank ||
+      scoring.unscored != defaults.unscored ||
+      scoring.multi_select != defaults.multi_select) {
+    j["scoring"] = scoring;
+  }
+}
+
+void from_json(const json& j, ExamAnswers& exam_answers) {
+  j.at("stage").get_to(exam_answers.stage);
+  const auto& answers = j.at("answers");
+  exam_answers.answers.clear();
+  exam_answers.weights.clear();
+  bool weighted =
+      std::any_of(answers.begin(), answers.end(),
+                  [](const json& answer) { return answer.contains("weight"); });
+  for (const auto& answer : answers) {
+    exam_answers.answers.push_back(answer.get<Answer>());
+    if (weighted) {
+      exam_answers.weights.push_back(answer.value("weight", 1.0));
+    }
+  }
+  exam_answers.scoring = j.value("scoring", StageScoring());
+}
+
+namespace {
+
+/**
+ * @brief Apply the answers and scoring of a patch to the key of its stage
+ */
+void patch_stage(ExamAnswers& key, const json& patch) {
+  if (patch.contains("scoring")) {
+    patch.at("scoring").get_to(key.scoring);
+  }
+  auto& answers = key.answers;
+  auto& weights = key.weights;
+  for (const auto& change : patch.value("answers", json::array())) {
+    auto qst_idx = change.at("qst_idx").get<i32>();
+    auto first = std::find_if(
+        answers.begin(), answers.end(),
+        [qst_idx](const Answer& answer) { return answer.qst_idx == qst_idx; });
+    auto index = static_cast<size_t>(first - answers.begin());
+    // a repeat of the question would shadow the patched answer
+    for (auto i = answers.size(); i-- > index + 1;) {
+      if (answers[i].qst_idx == qst_idx) {
+        answers.erase(answers.begin() + static_cast<ptrdiff_t>(i));
+        if (!weights.empty()) {
+          weights.erase(weights.begin() + static_cast<ptrdiff_t>(i));
+        }
+      }
+    }
+    if (change.value("remove", false)) {
+      if (index < answers.size()) {
+        answers.erase(answers.begin() + static_cast<ptrdiff_t>(index));
+        if (!weights.empty()) {
+          weights.erase(weights.begin() + static_cast<ptrdiff_t>(index));
+        }
+      }
+      continue;
+    }
+    auto answer = change.get<Answer>();
+    if (change.contains("weight") && weights.empty()) {
+      weights.assign(answers.size(), 1.0);
+    }
+    if (index < answers.size()) {
+      answers[index] = answer;
+      if (!weights.empty()) {
+        weights[index] = change.value("weight", weights[index]);
+      }
+    } else {
+      answers.push_back(answer);
+      if (!weights.empty()) {
+        weights.push_back(change.value("weight", 1.0));
+      }
+    }
+  }
+}
+
+}  // namespace
+
 void AnswersManager::load_from_json(const json& answers_json) {
+  std::lock_guard lock(_writer);
+  std::vector<ExamAnswers> changed;
   for (const auto& exam_answers : answers_json) {
-    auto ans = exam_answers.get<ExamAnswers>();
-    _answers[ans.stage] = ans;
+    changed.push_back(exam_answers.get<ExamAnswers>());
   }
+  _publish(std::move(changed));
 }
 
-std::string AnswersManager::serialize_for_mpi(
-    const std::vector<i32>& required_stages) const {
-  json serialized = json::array();
-  for (const auto& stage : required_stages) {
-    auto it = _answers.find(stage);
-    if (it != _answers.end()) {
-      serialized.push_back(it->second);
+void AnswersManager::patch_from_json(const json& patch_json) {
+  std::lock_guard lock(_writer);
+  auto current = snapshot();
+  std::vector<ExamAnswers> changed;
+  for (const auto& patch : patch_json) {
+    auto stage = patch.at("stage").get<i32>();
+    // patches of the same stage apply one after the other
+    auto it = std::find_if(
+        changed.begin(), changed.end(),
+        [stage](const ExamAnswers& key) { return key.stage == stage; });
+    if (it == changed.end()) {
+      auto known = current->_stages.find(stage);
+      changed.push_back(known != current->_stages.end()
+                            ? known->second->answers
+                            : ExamAnswers{stage, {}, {}, {}});
+      it = changed.end() - 1;
     }
+    patch_stage(*it, patch);
+  }
+  _publish(std::move(changed));
+}
+
+void AnswersManager::_publish(std::vector<ExamAnswers> changed) {
+  auto current = snapshot();
+  auto next = std::make_shared<AnswersSnapshot>();
+  next->_stages = current->_stages;
+  auto version = current->_version + 1;
+  bool modified = false;
+  for (auto& answers : changed) {
+    auto& stage = next->_stages[answers.stage];
+    if (stage && stage->answers == answers) {
+      continue;  // same key, keep its version and its encoding
+    }
+    stage = AnswersSnapshot::_stage(std::move(answers), version);
+    modified = true;
+  }
+  if (!modified) {
+    return;
+  }
+  next->_version = version;
+  next->_flatten();
+  _current.store(std::move(next), std::memory_order_release);
+}
+
+std::optional<size_t> AnswerKeys::index(i32 stage) const {
+  auto it = std::lower_bound(stages.begin(), stages.end(), stage,
+                             [](const AnswerKeyEntry& entry, i32 value) {
+                               return entry.stage < value;
+                             });
+  if (it == stages.end() || it->stage != stage) {
+    return std::nullopt;
   }
-  return serialized.dump();
+  return static_cast<size_t>(it - stages.begin());
 }
 
-void AnswersManager::deserialize_from_mpi(const std::string& serialized_data) {
-  json answers_json = json::parse(serialized_data);
-  load_from_json(answers_json);
+std::span<const Answer> AnswerKeys::find(i32 stage) const {
+  auto stage_index = index(stage);
+  if (!stage_index) {
+    return {};
+  }
+  const auto& entry = stages[*stage_index];
+  return answers.subspan(entry.offset, entry.size);
 }
 
-std::map<i32, i32> AnswersManager::get_answers(i32 stage) {
-  auto it = _cache_answers.find(stage);
-  if (it != _cache_answers.end()) {
-    return it->second;
+std::shared_ptr<const AnswersSnapshot::Stage> AnswersSnapshot::_stage(
+    ExamAnswers answers, u64 version) {
+  auto stage = std::make_shared<Stage>();
+  const bool weighted = !answers.weights.empty();
+  std::vector<std::pair<Answer, f64>> stage_answers;
+  for (size_t i = 0; i < answers.answers.size(); i++) {
+    stage_answers.emplace_back(answers.answers[i],
+                               weighted ? answers.weights[i] : 1.0);
   }
-  // cache miss
-  auto it_answers = _answers.find(stage);
-  if (it_answers == _answers.end()) {
-    return std::map<i32, i32>();
+  // when a question is repeated the last answer wins
+  std::stable_sort(stage_answers.begin(), stage_answers.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.first.qst_idx < b.first.qst_idx;
+                   });
+  auto last = std::unique(stage_answers.rbegin(), stage_answers.rend(),
+                          [](const auto& a, const auto& b) {
+                            return a.first.qst_idx == b.first.qst_idx;
+                          });
+  stage_answers.erase(stage_answers.begin(), last.base());
+  f64 total_weight = 0.0;
+  for (const auto& [answer, weight] : stage_answers) {
+    stage->sorted.push_back(answer);
+    stage->weights.push_back(weight);
+    total_weight += weight;
   }
-  auto vec_answers = it_answers->second.answers;
-  std::map<i32, i32> correct_answers;
-  for (const auto& answer : vec_answers) {
-    correct_answers[answer.qst_idx] = answer.rans_idx;
+  bool multi_select = std::any_of(
+      stage_answers.begin(), stage_answers.end(),
+      [](const auto& entry) { return entry.first.rans_mask != 0; });
+  const auto& scoring = answers.scoring;
+  auto policy = ScoringPolicy::UNIFORM;
+  if (weighted) {
+    policy = ScoringPolicy::WEIGHTED;
+  } else if (scoring.wrong == 0.0 && scoring.blank == 0.0 &&
+             scoring.unscored == 0.0) {
+    policy = ScoringPolicy::NO_PENALTY;
+  }
+  stage->entry = {answers.stage, 0, static_cast<u32>(stage_answers.size()),
+                  policy, multi_select, scoring, total_weight};
+  stage->json = json(answers).dump();
+  stage->answers = std::move(answers);
+  stage->version = version;
+  return stage;
+}
+
+void AnswersSnapshot::_flatten() {
+  _key_stages.clear();
+  _key_answers.clear();
+  _key_weights.clear();
+  for (const auto& [id, stage] : _stages) {
+    auto entry = stage->entry;
+    entry.offset = static_cast<u32>(_key_answers.size());
+    _key_stages.push_back(entry);
+    _key_answers.insert(_key_answers.end(), stage->sorted.begin(),
+                        stage->sorted.end());
+    _key_weights.insert(_key_weights.end(), stage->weights.begin(),
+                        stage->weights.end());
+  }
+}
+
+std::string AnswersSnapshot::save_to_json(std::span<const i32> stages,
+                                          u64 newer_than) const {
+  std::string answers_json = "[";
+  auto append = [&](i32 id) {
+    auto it = _stages.find(id);
+    if (it == _stages.end() || it->second->version <= newer_than) {
+      return;
+    }
+    if (answers_json.size() > 1) {
+      answers_json += ",";
+    }
+    answers_json += it->second->json;
+  };
+  if (stages.empty()) {
+    for (const auto& [id, stage] : _stages) {
+      append(id);
+    }
+  } else {
+    std::for_each(stages.begin(), stages.end(), append);
   }
-  _cache_answers[stage] = correct_answers;
-  return correct_answers;
+  answers_json += "]";
+  return answers_json;
 }
 
-std::string AnswersManager::save_to_json() const {
-  json answers_json = json::array();
-  for (const auto& [stage, answers] : _answers) {
-    answers_json.push_back(answers);
+u64 AnswersSnapshot::version(std::span<const i32> stages) const {
+  if (stages.empty()) {
+    return _version;
   }
-  return answers_json.dump();
-}
\ No newline at end of file
+  u64 latest = 0;
+  for (auto id : stages) {
+    auto it = _stages.find(id);
+    if (it != _stages.end()) {
+      latest = std::max(latest, it->second->version);
+    }
+  }
+  return latest;
+}
@@ -2,43 +2,264 @@
 #ifndef ANSWERS_HPP
 #define ANSWERS_HPP
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <optional>
+#include <span>
 #include <string>
 #include <system/aliases.hpp>
 #include <vector>
 
 using json = nlohmann::json;
 
+/**
+ * @brief Multi-select ("select all that apply") answers
+ * @details A selection is a bitmask of options 1..MAX_OPTIONS, option k being
+ *          bit k - 1. In JSON it is an array of options, e.g. "rans_idx":
+ *          [1, 3]. A student selection travels in MPIQuestion::ans_idx with
+ *          MULTI_SELECT_FLAG set, so it is never mistaken for the index of a
+ *          single option.
+ */
+static constexpr u32 MULTI_SELECT_FLAG = 0x80000000u;
+static constexpr i32 MAX_OPTIONS = 31;
+
+/**
+ * @brief Bitmask of a JSON array of options
+ */
+u32 options_mask(const json& options);
+
+/**
+ * @brief JSON array of the options of a bitmask
+ */
+json mask_options(u32 mask);
+
+/**
+ * @brief Options selected by a student answer, as a bitmask
+ * @details A plain index selects a single option.
+ */
+inline u32 selected_options(i32 ans_idx) {
+  auto raw = static_cast<u32>(ans_idx);
+  if (raw & MULTI_SELECT_FLAG) {
+    return raw & ~MULTI_SELECT_FLAG;
+  }
+  return ans_idx >= 1 && ans_idx <= MAX_OPTIONS ? 1u << (ans_idx - 1) : 0u;
+}
+
 struct Answer {
   i32 qst_idx;
   i32 rans_idx;
-  NLOHMANN_DEFINE_TYPE_INTRUSIVE(Answer, qst_idx, rans_idx)
+  u32 rans_mask; /** Correct options of a multi-select question, else 0 */
+
+  bool operator==(const Answer&) const = default;
 };
 
+void to_json(json& j, const Answer& answer);
+void from_json(const json& j, Answer& answer);
+
+/**
+ * @brief How a multi-select question is scored
+ */
+enum class MultiSelectRule : u8 {
+  EXACT = 0,   /** Full credit only for exactly the correct options */
+  PARTIAL = 1, /** Credit (right picks - wrong picks) / correct options */
+};
+
+NLOHMANN_JSON_SERIALIZE_ENUM(MultiSelectRule,
+                             {{MultiSelectRule::EXACT, "exact"},
+                              {MultiSelectRule::PARTIAL, "partial"}})
+
+/**
+ * @brief Shape of the scoring of a stage, picks the evaluator kernel
+ */
+enum class ScoringPolicy : u8 {
+  NO_PENALTY = 0, /** Only correct answers score */
+  UNIFORM = 1,    /** Same points for every question, penalties allowed */
+  WEIGHTED = 2,   /** Points of each question scaled by its weight */
+};
+
+/**
+ * @brief Points given to each outcome of a question of a stage
+ */
+struct StageScoring {
+  f64 correct = 1.0;  /** Correct answer */
+  f64 wrong = 0.0;    /** Wrong answer (negative marking) */
+  f64 blank = 0.0;    /** Question of the key left unanswered */
+  f64 unscored = 0.0; /** Answer to a question missing from the key */
+  MultiSelectRule multi_select = MultiSelectRule::EXACT;
+  NLOHMANN_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(StageScoring, correct, wrong,
+                                              blank, unscored, multi_select)
+
+  bool operator==(const StageScoring&) const = default;
+};
+
+/**
+ * @brief Answer key of a stage
+ * @details In JSON, `scoring` and the `weight` of each answer are optional:
+ *          {"stage": 1, "scoring": {"wrong": -0.25},
+ *           "answers": [{"qst_idx": 1, "rans_idx": 3, "weight": 2},
+ *                       {"qst_idx": 2, "rans_idx": [1, 4]}]}
+ */
 struct ExamAnswers {
   i32 stage;
   std::vector<Answer> answers;
-  NLOHMANN_DEFINE_TYPE_INTRUSIVE(ExamAnswers, stage, answers)
+  std::vector<f64> weights; /** Weight of each answer, empty if unweighted */
+  StageScoring scoring;
+
+  bool operator==(const ExamAnswers&) const = default;
+};
+
+void to_json(json& j, const ExamAnswers& exam_answers);
+void from_json(const json& j, ExamAnswers& exam_answers);
+
+/**
+ * @brief Position of one stage inside a flat answer key table
+ */
+struct AnswerKeyEntry {
+  i32 stage;
+  u32 offset;
+  u32 size;
+  ScoringPolicy policy;
+  bool multi_select; /** Whether any question of the key is multi-select */
+  StageScoring scoring;
+  f64 total_weight; /** Sum of the weights of the answers */
 };
 
+/**
+ * @brief Read-only view of flat answer keys
+ * @details Stages are sorted by stage and the answers of each stage by
+ *          qst_idx, so the view works the same over the tables of a snapshot
+ *          or over a node shared-memory window. Each stage carries its scoring
+ *          policy, resolved once when the tables are built.
+ */
+struct AnswerKeys {
+  std::span<const AnswerKeyEntry> stages;
+  std::span<const Answer> answers;
+  std::span<const f64> weights; /** Weight of each answer, 1 if unweighted */
+
+  /**
+   * @brief Get the position of a stage in `stages`, if the stage is known
+   */
+  std::optional<size_t> index(i32 stage) const;
+
+  /**
+   * @brief Get the answer key of a stage, empty if the stage is unknown
+   */
+  std::span<const Answer> find(i32 stage) const;
+};
+
+/**
+ * @brief Immutable version of the answer keys of every stage
+ * @details Keys are versioned: a load that changes at least one stage bumps
+ *          the version and tags the changed stages with it, a stage loaded
+ *          again unchanged keeps its version. Each stage is encoded to JSON
+ *          and flattened once, when it changes, and shared with the next
+ *          snapshots until it changes again, so GET_ANSWERS and the key
+ *          broadcasts never re-encode unchanged stages.
+ */
+class AnswersSnapshot {
+ public:
+  /**
+   * @brief Flat view of the keys, valid as long as the snapshot
+   */
+  AnswerKeys keys() const {
+    return AnswerKeys{_key_stages, _key_answers, _key_weights};
+  }
+
+  /**
+   * @brief JSON array of the keys of some stages
+   * @param stages Stages to include, unknown ones are skipped; every stage
+   *               when empty
+   * @param newer_than Only include the stages changed after this version
+   */
+  std::string save_to_json(std::span<const i32> stages = {},
+                           u64 newer_than = 0) const;
+
+  /**
+   * @brief Latest version of some stages, 0 if none of them is known
+   * @param stages Stages to look at, every stage when empty
+   */
+  u64 version(std::span<const i32> stages = {}) const;
+
+ private:
+  friend class AnswersManager;
+
+  /**
+   * @brief Key of one stage as published, shared between snapshots
+   */
+  struct Stage {
+    ExamAnswers answers;
+    u64 version;                 /** Load that last changed the stage */
+    std::string json;            /** Encoded answers */
+    std::vector<Answer> sorted;  /** By qst_idx, the last repeat wins */
+    std::vector<f64> weights;    /** Of `sorted`, 1 if unweighted */
+    AnswerKeyEntry entry;        /** Offset left to the snapshot */
+  };
+
+  u64 _version = 0; /** Version of the last load that changed a stage */
+  std::map<i32, std::shared_ptr<const Stage>> _stages;
+  // flat tables behind keys()
+  std::vector<AnswerKeyEntry> _key_stages;
+  std::vector<Answer> _key_answers;
+  std::vector<f64> _key_weights;
+
+  static std::shared_ptr<const Stage> _stage(ExamAnswers answers,
+                                             u64 version);
+  void _flatten();
+};
+
+/**
+ * @brief Publishes the answer keys as a series of snapshots
+ * @details Readers take the current snapshot and keep it for as long as they
+ *          need, e.g. a review for all its chunks, without locking: a load or
+ *          a patch copies the current snapshot, changes the copy and swaps it
+ *          in atomically (RCU-style). An old snapshot lives until its last
+ *          reader drops it, so a reader never sees a half-updated key.
+ *          Writers are serialized among themselves.
+ */
 class AnswersManager {
  public:
   static AnswersManager& instance();
   ~AnswersManager() = default;
+
+  /**
+   * @brief Current keys
+   */
+  std::shared_ptr<const AnswersSnapshot> snapshot() const {
+    return _current.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Replace the keys of the stages in `answers_json`
+   * @details All or nothing: nothing is published if a stage is invalid.
+   */
   void load_from_json(const json& answers_json);
-  std::string serialize_for_mpi(const std::vector<i32>& required_stages) const;
-  void deserialize_from_mpi(const std::string& serialized_data);
-  std::map<i32, i32> get_answers(i32 stage);
-  std::string save_to_json() const;
+
+  /**
+   * @brief Change some questions of some stages
+   * @param patch_json Array of {"stage": S, "answers": [...], "scoring": {}}.
+   *                   Each answer replaces the key of its qst_idx, or is added
+   *                   if the stage has none; {"qst_idx": Q, "remove": true}
+   *                   drops it. `scoring`, when present, replaces the scoring
+   *                   of the stage. An unknown stage is created.
+   * @details All or nothing, like load_from_json().
+   */
+  void patch_from_json(const json& patch_json);
 
  private:
-  AnswersManager() = default;
+  AnswersManager();
   static std::unique_ptr<AnswersManager> _instance;
-  std::map<i32, ExamAnswers> _answers;
-  std::map<i32, std::map<i32, i32>> _cache_answers;
+  std::atomic<std::shared_ptr<const AnswersSnapshot>> _current;
+  std::mutex _writer;
+
+  /**
+   * @brief Publish a copy of the current snapshot with `changed` replaced
+   * @details Stages equal to their current key are left as they are, nothing
+   *          is published when no stage changes.
+   */
+  void _publish(std::vector<ExamAnswers> changed);
 };
 
 #endif  // ANSWERS_HPP
\ No newline at end of file
@@ -1,6 +1,13 @@
 #include "coordinator.hpp"
 #include <spdlog/spdlog.h>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <domain/analytics.hpp>
 #include <domain/answers.hpp>
+#include <domain/exam_batch.hpp>
+#include <domain/exam_codec.hpp>
+#include <domain/ranking.hpp>
 
 std::unique_ptr<MPICoordinator> MPICoordinator::_instance = nullptr;
 
@@ -14,6 +21,12 @@ MPICoordinator& MPICoordinator::instance() {
 MPICoordinator::MPICoordinator() {
   create_types();
   set_config(CoordinatorConfig());
+  i32 mpi_size = 0;
+  MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+  for (i32 rank = 1; rank < mpi_size; rank++) {  // 0 is master
+    _workers.push_back(rank);
+  }
+  _next_worker_rank = mpi_size;
 }
 
 void MPICoordinator::set_config(const CoordinatorConfig& config) {
@@ -79,9 +92,10 @@ MPICoordinator::~MPICoordinator() {
 
 void MPICoordinator::send_exam_batch(const std::vector<MPIExam>& exams,
                                      i32 dest_rank, i32 tag) {
+  auto peer = _endpoint(dest_rank);
   i32 exams_size = exams.size();
   auto send_result =
-      MPI_Send(&exams_size, 1, MPI_INT, dest_rank, tag, MPI_COMM_WORLD);
+      MPI_Send(&exams_size, 1, MPI_INT, peer.rank, tag, peer.comm);
   if (send_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to send exam batch size");
   }
@@ -90,14 +104,14 @@ void MPICoordinator::send_exam_batch(const std::vector<MPIExam>& exams,
   for (const auto& exam : exams) {
     size = static_cast<i32>(exam.answers.size());
     header = {exam.stage, exam.id_exam, size};
-    send_result = MPI_Send(&header, 1, _mpi_exam_header_type, dest_rank, tag,
-                           MPI_COMM_WORLD);
+    send_result = MPI_Send(&header, 1, _mpi_exam_header_type, peer.rank, tag,
+                           peer.comm);
     if (send_result != MPI_SUCCESS) {
       throw std::runtime_error("Failed to send exam header");
     }
     if (!exam.answers.empty()) {
       send_result = MPI_Send(exam.answers.data(), size, _mpi_question_type,
-                             dest_rank, tag, MPI_COMM_WORLD);
+                             peer.rank, tag, peer.comm);
       if (send_result != MPI_SUCCESS) {
         throw std::runtime_error("Failed to send exam answers");
       }
@@ -105,219 +119,673 @@ void MPICoordinator::send_exam_batch(const std::vector<MPIExam>& exams,
   }
 }
 
-std::vector<MPIExam> MPICoordinator::receive_exam_batch(i32 source_rank,
-                                                        i32 tag) {
+void MPICoordinator::receive_exam_batch(i32 source_rank, i32 tag,
+                                        ExamBatch& batch) {
+  auto peer = _endpoint(source_rank);
   i32 batch_size = 0;
-  auto recv_result = MPI_Recv(&batch_size, 1, MPI_INT, source_rank, tag,
-                              MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  auto recv_result = MPI_Recv(&batch_size, 1, MPI_INT, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
   if (recv_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to receive exam batch size");
   }
-  if (batch_size <= 0 || batch_size > std::numeric_limits<i16>::max()) {
+  if (batch_size <= 0) {
     throw std::runtime_error("Invalid exam batch size");
   }
-  std::vector<MPIExam> exams(batch_size);
+  u64 batch_bytes = u64{static_cast<u32>(batch_size)} * sizeof(MPIExamHeader);
+  _check_budget(batch_bytes, "Exam batch");
+  batch.reset();
+  batch.reserve(batch_size, 0);
   MPIExamHeader header;
-  for (auto& exam : exams) {
-    recv_result = MPI_Recv(&header, 1, _mpi_exam_header_type, source_rank, tag,
-                           MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  for (i32 i = 0; i < batch_size; i++) {
+    recv_result = MPI_Recv(&header, 1, _mpi_exam_header_type, peer.rank, tag,
+                           peer.comm, MPI_STATUS_IGNORE);
     if (recv_result != MPI_SUCCESS) {
       throw std::runtime_error("Failed to receive exam header");
     }
+    if (header.answers_size < 0) {
+      throw std::runtime_error("Invalid exam answers size");
+    }
+    batch_bytes += u64{static_cast<u32>(header.answers_size)} *
+                   sizeof(MPIQuestion);
+    _check_budget(batch_bytes, "Exam batch");
+    auto* answers =
+        batch.append(header.stage, header.id_exam, header.answers_size);
     if (header.answers_size > 0) {
-      exam.answers.resize(header.answers_size);
       recv_result =
-          MPI_Recv(exam.answers.data(), header.answers_size, _mpi_question_type,
-                   source_rank, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+          MPI_Recv(answers, header.answers_size, _mpi_question_type,
+                   peer.rank, tag, peer.comm, MPI_STATUS_IGNORE);
       if (recv_result != MPI_SUCCESS) {
         throw std::runtime_error("Failed to receive exam answers");
       }
     }
-    exam.stage = header.stage;
-    exam.id_exam = header.id_exam;
   }
-  return exams;
+}
+
+void MPICoordinator::send_compact_exam_batch(const std::vector<MPIExam>& exams,
+                                             i32 dest_rank, i32 tag) {
+  auto peer = _endpoint(dest_rank);
+  std::string encoded;
+  ExamCodec::encode(exams, encoded);
+  u64 answers = 0;
+  for (const auto& exam : exams) {
+    answers += exam.answers.size();
+  }
+  // the answers let a node leader size its window before decoding
+  u64 sizes[] = {exams.size(), encoded.size(), answers};
+  auto send_result =
+      MPI_Send(sizes, 3, MPI_UINT64_T, peer.rank, tag, peer.comm);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send compact exam batch size");
+  }
+  send_result =
+      _send_pieces(encoded.data(), sizes[1], MPI_BYTE, 1, peer, tag);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send compact exam batch");
+  }
+}
+
+void MPICoordinator::receive_compact_exam_batch(i32 source_rank, i32 tag,
+                                                ExamBatch& batch) {
+  auto encoded = receive_encoded_exam_batch(source_rank, tag);
+  ExamCodec::decode(*encoded.data, static_cast<i32>(encoded.exams), batch);
+}
+
+EncodedBatch MPICoordinator::receive_encoded_exam_batch(i32 source_rank,
+                                                        i32 tag) {
+  auto peer = _endpoint(source_rank);
+  u64 sizes[] = {0, 0, 0};  // exams, bytes, answers
+  auto recv_result = MPI_Recv(sizes, 3, MPI_UINT64_T, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive compact exam batch size");
+  }
+  // every answer takes at least half a byte
+  if (sizes[0] == 0 || sizes[0] > std::numeric_limits<i32>::max() ||
+      sizes[1] == 0 || sizes[2] > sizes[1] * 2) {
+    throw std::runtime_error("Invalid compact exam batch size");
+  }
+  _check_budget(sizes[1], "Compact exam batch");
+  // the buffer is reused, it only grows up to the budget
+  _encoded.resize(sizes[1]);
+  recv_result =
+      _receive_pieces(_encoded.data(), sizes[1], MPI_BYTE, 1, peer, tag);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive compact exam batch");
+  }
+  return EncodedBatch{sizes[0], sizes[2], &_encoded};
 }
 
 void MPICoordinator::send_answers(const std::string& answers, i32 dest_rank,
                                   i32 tag) {
-  i32 answers_size = answers.size();
+  auto peer = _endpoint(dest_rank);
+  u64 answers_size = answers.size();
   auto send_result =
-      MPI_Send(&answers_size, 1, MPI_INT, dest_rank, tag, MPI_COMM_WORLD);
+      MPI_Send(&answers_size, 1, MPI_UINT64_T, peer.rank, tag, peer.comm);
   if (send_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to send answers size");
   }
-  send_result = MPI_Send(answers.data(), answers_size, MPI_CHAR, dest_rank, tag,
-                         MPI_COMM_WORLD);
+  send_result =
+      _send_pieces(answers.data(), answers_size, MPI_CHAR, 1, peer, tag);
   if (send_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to send answers");
   }
 }
 
 std::string MPICoordinator::receive_answers(i32 source_rank, i32 tag) {
-  i32 answers_size = 0;
-  auto recv_result = MPI_Recv(&answers_size, 1, MPI_INT, source_rank, tag,
-                              MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  auto peer = _endpoint(source_rank);
+  u64 answers_size = 0;
+  auto recv_result = MPI_Recv(&answers_size, 1, MPI_UINT64_T, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
   if (recv_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to receive answers size");
   }
-  if (answers_size <= 0 || answers_size > std::numeric_limits<i16>::max()) {
+  if (answers_size == 0) {
     throw std::runtime_error("Invalid answers size");
   }
+  _check_budget(answers_size, "Answers");
   std::string answers(answers_size, '\0');
-  recv_result = MPI_Recv(answers.data(), answers_size, MPI_CHAR, source_rank,
-                         tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  recv_result =
+      _receive_pieces(answers.data(), answers_size, MPI_CHAR, 1, peer, tag);
   if (recv_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to receive answers");
   }
   return answers;
 }
 
-void MPICoordinator::send_results(const std::vector<MPIResult>& results,
+void MPICoordinator::send_results(std::span<const MPIResult> results,
                                   i32 dest_rank, i32 tag) {
-  i32 results_size = results.size();
+  auto peer = _endpoint(dest_rank);
+  u64 results_size = results.size();
   auto send_result =
-      MPI_Send(&results_size, 1, MPI_INT, dest_rank, tag, MPI_COMM_WORLD);
+      MPI_Send(&results_size, 1, MPI_UINT64_T, peer.rank, tag, peer.comm);
   if (send_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to send results size");
   }
-  for (const auto& result : results) {
-    send_result =
-        MPI_Send(&result, 1, _mpi_result_type, dest_rank, tag, MPI_COMM_WORLD);
-    if (send_result != MPI_SUCCESS) {
-      throw std::runtime_error("Failed to send results");
-    }
+  send_result = _send_pieces(results.data(), results_size, _mpi_result_type,
+                             sizeof(MPIResult), peer, tag);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send results");
   }
 }
 
 std::vector<MPIResult> MPICoordinator::receive_results(i32 source_rank,
                                                        i32 tag) {
-  i32 results_size = 0;
-  auto recv_result = MPI_Recv(&results_size, 1, MPI_INT, source_rank, tag,
-                              MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  auto peer = _endpoint(source_rank);
+  u64 results_size = 0;
+  auto recv_result = MPI_Recv(&results_size, 1, MPI_UINT64_T, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
   if (recv_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to receive results size");
   }
-  if (results_size <= 0 || results_size > std::numeric_limits<i16>::max()) {
+  if (results_size == 0) {
     throw std::runtime_error("Invalid results size");
   }
+  _check_budget(results_size * sizeof(MPIResult), "Results");
   std::vector<MPIResult> results(results_size);
-  for (auto& result : results) {
-    recv_result = MPI_Recv(&result, 1, _mpi_result_type, source_rank, tag,
-                           MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    if (recv_result != MPI_SUCCESS) {
-      throw std::runtime_error("Failed to receive results");
-    }
+  recv_result = _receive_pieces(results.data(), results_size, _mpi_result_type,
+                                sizeof(MPIResult), peer, tag);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive results");
   }
   return results;
 }
 
-std::vector<std::vector<MPIExam>> MPICoordinator::_slice_exams(
-    const json& exams, i32 mpi_size) {
+void MPICoordinator::send_analytics(const Analytics& analytics, i32 dest_rank,
+                                    i32 tag) {
+  auto peer = _endpoint(dest_rank);
+  std::string packed;
+  analytics.pack(packed);
+  i32 packed_size = packed.size();
+  auto send_result =
+      MPI_Send(&packed_size, 1, MPI_INT, peer.rank, tag, peer.comm);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send analytics size");
+  }
+  send_result = MPI_Send(packed.data(), packed_size, MPI_BYTE, peer.rank, tag,
+                         peer.comm);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send analytics");
+  }
+}
+
+void MPICoordinator::receive_analytics(i32 source_rank, i32 tag,
+                                       Analytics& analytics) {
+  auto peer = _endpoint(source_rank);
+  i32 packed_size = 0;
+  auto recv_result = MPI_Recv(&packed_size, 1, MPI_INT, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive analytics size");
+  }
+  if (packed_size < 0) {
+    throw std::runtime_error("Invalid analytics size");
+  }
+  std::string packed(packed_size, '\0');
+  recv_result = MPI_Recv(packed.data(), packed_size, MPI_BYTE, peer.rank, tag,
+                         peer.comm, MPI_STATUS_IGNORE);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive analytics");
+  }
+  analytics.unpack(packed);
+}
+
+void MPICoordinator::send_score_counts(std::span<const ScoreCount> counts,
+                                       i32 dest_rank, i32 tag) {
+  auto peer = _endpoint(dest_rank);
+  u64 counts_size = counts.size();
+  auto send_result =
+      MPI_Send(&counts_size, 1, MPI_UINT64_T, peer.rank, tag, peer.comm);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send score counts size");
+  }
+  send_result = _send_pieces(counts.data(), counts_size * sizeof(ScoreCount),
+                             MPI_BYTE, 1, peer, tag);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send score counts");
+  }
+}
+
+void MPICoordinator::receive_score_counts(i32 source_rank, i32 tag,
+                                          std::vector<ScoreCount>& counts) {
+  auto peer = _endpoint(source_rank);
+  u64 counts_size = 0;
+  auto recv_result = MPI_Recv(&counts_size, 1, MPI_UINT64_T, peer.rank, tag,
+                              peer.comm, MPI_STATUS_IGNORE);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive score counts size");
+  }
+  _check_budget(counts_size * sizeof(ScoreCount), "Score counts");
+  counts.resize(counts_size);
+  recv_result = _receive_pieces(counts.data(),
+                                counts_size * sizeof(ScoreCount), MPI_BYTE, 1,
+                                peer, tag);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive score counts");
+  }
+}
+
+std::vector<MPIExam> MPICoordinator::parse_exams(const json& exams) {
   try {
-    i32 workers_size = mpi_size - 1;  // 0 is master
-    i32 exams_per_worker =
-        std::ceil(static_cast<double>(exams.size()) / workers_size);
-    std::vector<std::vector<MPIExam>> exams_slices(workers_size);
-
-    i32 start_idx = 0;
-    i32 end_idx = 0;
-    for (i32 i = 0; i < workers_size; i++) {
-      start_idx = i * exams_per_worker;
-      end_idx =
-          (i == workers_size - 1) ? exams.size() : start_idx + exams_per_worker;
-      auto slice_size = end_idx - start_idx;
-      exams_slices[i].resize(slice_size);
-      for (i32 j = start_idx; j < end_idx; j++) {
-        json exam = exams[j];
-        auto& slice = exams_slices[i];
-        MPIExam& mpi_exam = slice[j - start_idx];
-        mpi_exam.stage = exam["stage"];
-        mpi_exam.id_exam = exam["id_exam"];
-        mpi_exam.answers.resize(exam["answers"].size());
-        for (size_t k = 0; k < exam["answers"].size(); k++) {
-          mpi_exam.answers[k].qst_idx = exam["answers"][k]["qst_idx"];
-          mpi_exam.answers[k].ans_idx = exam["answers"][k]["ans_idx"];
-        }
+    std::vector<MPIExam> mpi_exams(exams.size());
+    for (size_t j = 0; j < exams.size(); j++) {
+      const json& exam = exams[j];
+      MPIExam& mpi_exam = mpi_exams[j];
+      mpi_exam.stage = exam["stage"];
+      mpi_exam.id_exam = exam["id_exam"];
+      mpi_exam.answers.resize(exam["answers"].size());
+      for (size_t k = 0; k < exam["answers"].size(); k++) {
+        mpi_exam.answers[k].qst_idx = exam["answers"][k]["qst_idx"];
+        const auto& ans_idx = exam["answers"][k]["ans_idx"];
+        // a multi-select answer is sent as a flagged bitmask
+        mpi_exam.answers[k].ans_idx =
+            ans_idx.is_array()
+                ? static_cast<i32>(options_mask(ans_idx) | MULTI_SELECT_FLAG)
+                : ans_idx.get<i32>();
+      }
+    }
+    return mpi_exams;
+  } catch (std::exception& e) {
+    spdlog::error("Error parsing exams: {}", e.what());
+    throw;
+  }
+}
+
+std::vector<std::vector<MPIExam>> MPICoordinator::slice_exams(
+    std::vector<MPIExam>&& exams, const std::vector<i32>& weights) {
+  i64 exams_size = static_cast<i64>(exams.size());
+  i64 total_weight = 0;
+  for (auto weight : weights) {
+    total_weight += weight;
+  }
+  if (total_weight <= 0) {
+    throw std::runtime_error("No workers to slice the exams over");
+  }
+  // slice i gets a share of the exams proportional to weights[i], slices
+  // may come out empty when there are fewer exams than total weight
+  std::vector<std::vector<MPIExam>> exams_slices(weights.size());
+  i64 weight_sum = 0;
+  for (size_t i = 0; i < weights.size(); i++) {
+    auto start_idx = weight_sum * exams_size / total_weight;
+    weight_sum += weights[i];
+    auto end_idx = weight_sum * exams_size / total_weight;
+    exams_slices[i].assign(std::make_move_iterator(exams.begin() + start_idx),
+                           std::make_move_iterator(exams.begin() + end_idx));
+  }
+  return exams_slices;
+}
+
+void MPICoordinator::send_review(const std::vector<MPIExam>& exams,
+                                 const AnswersSnapshot& answers,
+                                 i32 worker_rank) {
+  auto required_stages = std::vector<i32>(exams.size());
+  std::transform(exams.begin(), exams.end(), required_stages.begin(),
+                 [](const MPIExam& exam) { return exam.stage; });
+  std::sort(required_stages.begin(), required_stages.end());
+  required_stages.erase(
+      std::unique(required_stages.begin(), required_stages.end()),
+      required_stages.end());
+  auto answer_keys_serialized = answers.save_to_json(required_stages);
+  // refuse here rather than leave the worker halfway through a review
+  _check_budget(answer_keys_serialized.size(), "Answers");
+  u64 exams_bytes = exams.size() * sizeof(MPIExamHeader);
+  for (const auto& exam : exams) {
+    exams_bytes += exam.answers.size() * sizeof(MPIQuestion);
+  }
+  _check_budget(exams_bytes, "Exam batch");
+  auto command =
+      _config.compact_exams ? MPICommand::REVIEW_COMPACT : MPICommand::REVIEW;
+  send_command(command, worker_rank, _config.mpi_tag_command);
+  send_answers(answer_keys_serialized, worker_rank, _config.mpi_tag_answers);
+  if (_config.compact_exams) {
+    send_compact_exam_batch(exams, worker_rank, _config.mpi_tag_exams);
+  } else {
+    send_exam_batch(exams, worker_rank, _config.mpi_tag_exams);
+  }
+}
+
+void MPICoordinator::send_rank_request(i32 top_k, i32 worker_rank) {
+  send_command(MPICommand::RANK, worker_rank, _config.mpi_tag_command);
+  auto peer = _endpoint(worker_rank);
+  auto send_result = MPI_Send(&top_k, 1, MPI_INT, peer.rank,
+                              _config.mpi_tag_command, peer.comm);
+  if (send_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to send top_k");
+  }
+}
+
+void MPICoordinator::send_shutdown_signal() {
+  auto workers = _workers;
+  for (auto worker_rank : workers) {
+    retire_worker(worker_rank);
+  }
+}
+
+void MPICoordinator::send_answer_keys(i32 worker_rank) {
+  send_command(MPICommand::ANSWERS, worker_rank, _config.mpi_tag_command);
+  send_answers(AnswersManager::instance().snapshot()->save_to_json(),
+               worker_rank, _config.mpi_tag_answers);
+}
+
+const std::vector<i32>& MPICoordinator::workers() const {
+  return _workers;
+}
+
+i32 MPICoordinator::worker_weight(i32 worker_rank) const {
+  auto it = _weights.find(worker_rank);
+  return it != _weights.end() ? it->second : 1;
+}
+
+void MPICoordinator::use_node_leaders(const std::map<i32, i32>& node_sizes) {
+  _workers.clear();
+  for (const auto& [leader_rank, node_size] : node_sizes) {
+    _workers.push_back(leader_rank);
+    _weights[leader_rank] = node_size;
+  }
+}
+
+void MPICoordinator::use_frontends(i32 frontends) {
+  std::erase_if(_workers,
+                [frontends](i32 rank) { return rank < frontends; });
+}
+
+std::vector<i32> MPICoordinator::spawn_workers(i32 count) {
+  if (_config.spawn_command.empty()) {
+    throw std::runtime_error("No spawn command configured");
+  }
+  // report spawn failures instead of aborting the whole job
+  MPI_Comm_set_errhandler(MPI_COMM_SELF, MPI_ERRORS_RETURN);
+  std::vector<i32> spawned;
+  size_t ready = 0;  // spawned workers that got their rank and the keys
+  try {
+    for (i32 i = 0; i < count; i++) {
+      // one spawn per worker, so each one can be disconnected on its own
+      MPI_Comm intercomm;
+      i32 error_code = MPI_SUCCESS;
+      auto spawn_result = MPI_Comm_spawn(
+          _config.spawn_command.c_str(), MPI_ARGV_NULL, 1, MPI_INFO_NULL, 0,
+          MPI_COMM_SELF, &intercomm, &error_code);
+      if (spawn_result != MPI_SUCCESS || error_code != MPI_SUCCESS) {
+        throw std::runtime_error("Failed to spawn worker");
       }
+      MPI_Comm merged;
+      auto merge_result = MPI_Intercomm_merge(intercomm, 0, &merged);
+      if (merge_result != MPI_SUCCESS) {
+        MPI_Comm_free(&intercomm);
+        throw std::runtime_error("Failed to merge worker communicator");
+      }
+      auto worker_rank = _next_worker_rank++;
+      _peers[worker_rank] = {merged, 1};
+      _intercomms[worker_rank] = intercomm;
+      spawned.push_back(worker_rank);
+      auto send_result = MPI_Send(&worker_rank, 1, MPI_INT, 1,
+                                  _config.mpi_tag_command, merged);
+      if (send_result != MPI_SUCCESS) {
+        throw std::runtime_error("Failed to send worker rank");
+      }
+      send_answer_keys(worker_rank);
+      ready++;
+      spdlog::info("Spawned worker {}", worker_rank);
     }
-    return exams_slices;
   } catch (std::exception& e) {
-    spdlog::error("Error slicing exams: {}", e.what());
-    return std::vector<std::vector<MPIExam>>();
+    // the workers only join once every one of them is set up
+    for (size_t i = 0; i < spawned.size(); i++) {
+      auto worker_rank = spawned[i];
+      if (i < ready) {
+        try {
+          // it detaches on its side, so the disconnect completes
+          send_command(MPICommand::SHUTDOWN, worker_rank,
+                       _config.mpi_tag_command);
+          _disconnect(worker_rank);
+          continue;
+        } catch (std::exception& shutdown_error) {
+          spdlog::error("Failed to stop worker {}: {}", worker_rank,
+                        shutdown_error.what());
+        }
+      }
+      // never told to stop, only its communicators are released here
+      MPI_Comm_free(&_peers[worker_rank].comm);
+      MPI_Comm_free(&_intercomms[worker_rank]);
+      _peers.erase(worker_rank);
+      _intercomms.erase(worker_rank);
+    }
+    throw;
   }
+  _workers.insert(_workers.end(), spawned.begin(), spawned.end());
+  return spawned;
 }
 
-void MPICoordinator::send_to_workers(const json& exams_to_review,
-                                     i32 mpi_size) {
-  auto exams_slices = _slice_exams(exams_to_review, mpi_size);
-  auto size = exams_slices.size();
-  for (size_t i = 0; i < size; i++) {
-    auto exam_slice = exams_slices[i];
-    auto required_stages = std::vector<i32>(exam_slice.size());
-    std::transform(exam_slice.begin(), exam_slice.end(),
-                   required_stages.begin(),
-                   [](const MPIExam& exam) { return exam.stage; });
-    auto answer_keys_serialized =
-        AnswersManager::instance().serialize_for_mpi(required_stages);
-    auto worker_rank = i + 1;  // 0 is master
-    send_command(MPICommand::REVIEW, worker_rank, _config.mpi_tag_command);
-    send_answers(answer_keys_serialized, worker_rank, _config.mpi_tag_answers);
-    send_exam_batch(exam_slice, worker_rank, _config.mpi_tag_exams);
+void MPICoordinator::retire_worker(i32 worker_rank) {
+  send_command(MPICommand::SHUTDOWN, worker_rank, _config.mpi_tag_command);
+  _disconnect(worker_rank);
+  std::erase(_workers, worker_rank);
+  _weights.erase(worker_rank);
+}
+
+i32 MPICoordinator::attach_to_parent(MPI_Comm parent) {
+  MPI_Comm merged;
+  auto merge_result = MPI_Intercomm_merge(parent, 1, &merged);  // master is 0
+  if (merge_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to merge master communicator");
   }
+  _peers[0] = {merged, 0};
+  _intercomms[0] = parent;
+  i32 worker_rank = 0;
+  auto recv_result = MPI_Recv(&worker_rank, 1, MPI_INT, 0,
+                              _config.mpi_tag_command, merged,
+                              MPI_STATUS_IGNORE);
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive worker rank");
+  }
+  return worker_rank;
 }
 
-void MPICoordinator::send_shutdown_signal(i32 mpi_size) {
-  for (i32 i = 0; i < mpi_size - 1; i++) {
-    auto worker_rank = i + 1;  // 0 is master
-    send_command(MPICommand::SHUTDOWN, worker_rank, _config.mpi_tag_command);
+void MPICoordinator::detach_from_master() {
+  _disconnect(0);
+}
+
+MPIEndpoint MPICoordinator::_endpoint(i32 rank) const {
+  auto it = _peers.find(rank);
+  if (it != _peers.end()) {
+    return it->second;
   }
+  return MPIEndpoint{MPI_COMM_WORLD, rank};
 }
 
-json MPICoordinator::receive_results_from_workers(i32 mpi_size) {
-  std::vector<MPIResult> results;
-  for (i32 i = 0; i < mpi_size - 1; i++) {
-    auto worker_rank = i + 1;  // 0 is master
-    auto worker_results = receive_results(worker_rank, _config.mpi_tag_results);
-    results.insert(results.end(), worker_results.begin(), worker_results.end());
+void MPICoordinator::_disconnect(i32 rank) {
+  auto it = _peers.find(rank);
+  if (it == _peers.end()) {
+    return;  // lives in MPI_COMM_WORLD
   }
-  json results_json = results;
-  return results_json;
+  // both sides free the merged communicator first, then disconnect the
+  // intercomm (disconnecting the merged one hangs on Open MPI)
+  MPI_Comm_free(&it->second.comm);
+  MPI_Comm_disconnect(&_intercomms[rank]);
+  _peers.erase(it);
+  _intercomms.erase(rank);
 }
 
-std::pair<std::vector<MPIExam>, MPICommand> MPICoordinator::receive_from_master(
-    i32 master_rank) {
+i32 MPICoordinator::_send_pieces(const void* data, u64 count,
+                                 MPI_Datatype type, u64 type_size,
+                                 const MPIEndpoint& peer, i32 tag) const {
+  auto piece = std::max<u64>(_config.max_message_bytes / type_size, 1);
+  piece = std::min<u64>(piece, std::numeric_limits<i32>::max());
+  // the pieces share the tag and the peer, MPI delivers them in order
+  std::vector<MPI_Request> requests;
+  requests.reserve((count + piece - 1) / piece);
+  const auto* bytes = static_cast<const u8*>(data);
+  for (u64 offset = 0; offset < count; offset += piece) {
+    auto size = static_cast<i32>(std::min(piece, count - offset));
+    auto& request = requests.emplace_back();
+    auto send_result = MPI_Isend(bytes + offset * type_size, size, type,
+                                 peer.rank, tag, peer.comm, &request);
+    if (send_result != MPI_SUCCESS) {
+      requests.pop_back();
+      MPI_Waitall(static_cast<i32>(requests.size()), requests.data(),
+                  MPI_STATUSES_IGNORE);
+      return send_result;
+    }
+  }
+  return MPI_Waitall(static_cast<i32>(requests.size()), requests.data(),
+                     MPI_STATUSES_IGNORE);
+}
+
+i32 MPICoordinator::_receive_pieces(void* data, u64 count, MPI_Datatype type,
+                                    u64 type_size, const MPIEndpoint& peer,
+                                    i32 tag) const {
+  auto piece = std::max<u64>(_config.max_message_bytes / type_size, 1);
+  piece = std::min<u64>(piece, std::numeric_limits<i32>::max());
+  std::vector<MPI_Request> requests;
+  requests.reserve((count + piece - 1) / piece);
+  auto* bytes = static_cast<u8*>(data);
+  for (u64 offset = 0; offset < count; offset += piece) {
+    auto size = static_cast<i32>(std::min(piece, count - offset));
+    auto& request = requests.emplace_back();
+    auto recv_result = MPI_Irecv(bytes + offset * type_size, size, type,
+                                 peer.rank, tag, peer.comm, &request);
+    if (recv_result != MPI_SUCCESS) {
+      requests.pop_back();
+      MPI_Waitall(static_cast<i32>(requests.size()), requests.data(),
+                  MPI_STATUSES_IGNORE);
+      return recv_result;
+    }
+  }
+  return MPI_Waitall(static_cast<i32>(requests.size()), requests.data(),
+                     MPI_STATUSES_IGNORE);
+}
+
+void MPICoordinator::_check_budget(u64 bytes, const char* what) const {
+  if (bytes > _config.max_batch_bytes) {
+    throw std::runtime_error(std::string(what) + " of " +
+                             std::to_string(bytes) +
+                             " bytes exceeds the budget of " +
+                             std::to_string(_config.max_batch_bytes));
+  }
+}
+
+std::optional<i32> MPICoordinator::probe_results(bool blocking) {
+  MPI_Status status;
+  i32 flag = 0;
+  if (blocking && _peers.empty()) {
+    auto probe_result = MPI_Probe(MPI_ANY_SOURCE, _config.mpi_tag_results,
+                                  MPI_COMM_WORLD, &status);
+    if (probe_result != MPI_SUCCESS) {
+      throw std::runtime_error("Failed to probe results");
+    }
+    return status.MPI_SOURCE;
+  }
+  while (true) {
+    auto probe_result = MPI_Iprobe(MPI_ANY_SOURCE, _config.mpi_tag_results,
+                                   MPI_COMM_WORLD, &flag, &status);
+    if (probe_result != MPI_SUCCESS) {
+      throw std::runtime_error("Failed to probe results");
+    }
+    if (flag) {
+      return status.MPI_SOURCE;
+    }
+    for (const auto& [rank, peer] : _peers) {
+      probe_result = MPI_Iprobe(peer.rank, _config.mpi_tag_results, peer.comm,
+                                &flag, &status);
+      if (probe_result != MPI_SUCCESS) {
+        throw std::runtime_error("Failed to probe results");
+      }
+      if (flag) {
+        return rank;
+      }
+    }
+    if (!blocking) {
+      return std::nullopt;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+std::vector<MPIResult> MPICoordinator::receive_from_worker(
+    i32 worker_rank, Analytics& analytics) {
+  auto results = receive_results(worker_rank, _config.mpi_tag_results);
+  receive_analytics(worker_rank, _config.mpi_tag_analytics, analytics);
+  return results;
+}
+
+void MPICoordinator::receive_scores_from_worker(
+    i32 worker_rank, std::vector<ScoreCount>& counts) {
+  receive_score_counts(worker_rank, _config.mpi_tag_ranking, counts);
+}
+
+MPICommand MPICoordinator::receive_from_master(i32 master_rank,
+                                               ExamBatch& batch, i32& top_k,
+                                               EncodedBatch* encoded) {
+  if (encoded != nullptr) {
+    *encoded = EncodedBatch{};
+  }
   auto command = receive_command(master_rank, _config.mpi_tag_command);
+  if (command == MPICommand::RANK) {
+    auto peer = _endpoint(master_rank);
+    auto recv_result = MPI_Recv(&top_k, 1, MPI_INT, peer.rank,
+                                _config.mpi_tag_command, peer.comm,
+                                MPI_STATUS_IGNORE);
+    if (recv_result != MPI_SUCCESS) {
+      throw std::runtime_error("Failed to receive top_k");
+    }
+    // the review to rank follows
+    i32 ignored = 0;
+    command = receive_from_master(master_rank, batch, ignored, encoded);
+    return command == MPICommand::REVIEW ? MPICommand::RANK : command;
+  }
   if (command == MPICommand::SHUTDOWN) {
-    return {std::vector<MPIExam>(), MPICommand::SHUTDOWN};
+    batch.reset();
+    return MPICommand::SHUTDOWN;
   }
-  if (command != MPICommand::REVIEW) {
+  if (command != MPICommand::REVIEW && command != MPICommand::REVIEW_COMPACT &&
+      command != MPICommand::ANSWERS) {
     throw std::runtime_error("Invalid command received from master");
   }
   auto answers = receive_answers(master_rank, _config.mpi_tag_answers);
   AnswersManager::instance().load_from_json(json::parse(answers));
-  auto exams = receive_exam_batch(master_rank, _config.mpi_tag_exams);
-  return {exams, command};
+  if (command == MPICommand::ANSWERS) {
+    batch.reset();
+    return command;
+  }
+  if (command == MPICommand::REVIEW_COMPACT) {
+    if (encoded != nullptr) {
+      batch.reset();
+      *encoded =
+          receive_encoded_exam_batch(master_rank, _config.mpi_tag_exams);
+    } else {
+      receive_compact_exam_batch(master_rank, _config.mpi_tag_exams, batch);
+    }
+    return MPICommand::REVIEW;
+  }
+  receive_exam_batch(master_rank, _config.mpi_tag_exams, batch);
+  return command;
 }
 
-void MPICoordinator::send_to_master(const std::vector<MPIResult>& results,
+void MPICoordinator::send_to_master(std::span<const MPIResult> results,
+                                    const Analytics& analytics,
                                     i32 master_rank) {
   send_results(results, master_rank, _config.mpi_tag_results);
+  send_analytics(analytics, master_rank, _config.mpi_tag_analytics);
+}
+
+void MPICoordinator::send_scores_to_master(std::span<const ScoreCount> counts,
+                                           i32 master_rank) {
+  send_score_counts(counts, master_rank, _config.mpi_tag_ranking);
 }
 
 void MPICoordinator::send_command(MPICommand command, i32 dest_rank, i32 tag) {
+  auto peer = _endpoint(dest_rank);
   auto command_num = static_cast<u8>(command);
-  auto send_result = MPI_Send(&command_num, 1, MPI_UNSIGNED_CHAR, dest_rank,
-                              tag, MPI_COMM_WORLD);
+  auto send_result = MPI_Send(&command_num, 1, MPI_UNSIGNED_CHAR, peer.rank,
+                              tag, peer.comm);
   if (send_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to send command");
   }
 }
 
 MPICommand MPICoordinator::receive_command(i32 source_rank, i32 tag) {
+  auto peer = _endpoint(source_rank);
   u8 command_num = 0;
-  auto recv_result = MPI_Recv(&command_num, 1, MPI_UNSIGNED_CHAR, source_rank,
-                              tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  auto recv_result = MPI_Recv(&command_num, 1, MPI_UNSIGNED_CHAR, peer.rank,
+                              tag, peer.comm, MPI_STATUS_IGNORE);
   if (recv_result != MPI_SUCCESS) {
     throw std::runtime_error("Failed to receive command");
   }
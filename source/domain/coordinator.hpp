@@ -3,18 +3,43 @@
 #define COORDINATOR_HPP
 
 #include <mpi.h>
+#include <map>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <span>
+#include <string>
 #include <system/aliases.hpp>
 #include <vector>
 
 using json = nlohmann::json;
 
+class Analytics;
+class AnswersSnapshot;
+class ExamBatch;
+struct ScoreCount;
+
 struct CoordinatorConfig {
   i32 mpi_tag_answers = 100;
   i32 mpi_tag_exams = 101;
   i32 mpi_tag_results = 102;
   i32 mpi_tag_command = 103;
+  i32 mpi_tag_analytics = 104;
+  i32 mpi_tag_ranking = 105;
+  bool compact_exams = true;  // send exams through ExamCodec
+  std::string spawn_command;  // executable started by spawn_workers()
+  u64 max_message_bytes = 1 << 20;  // larger payloads go in several messages
+  u64 max_batch_bytes = 512 << 20;  // largest payload a rank accepts at once
+};
+
+/**
+ * @brief Where a peer lives: communicator and rank inside it
+ * @details Workers started by mpirun are reached through MPI_COMM_WORLD;
+ *          spawned workers through the communicator merged with the master.
+ */
+struct MPIEndpoint {
+  MPI_Comm comm;
+  i32 rank;
 };
 
 struct MPIQuestion {
@@ -37,6 +62,18 @@ struct MPIExamHeader {
 enum class MPICommand : u8 {
   SHUTDOWN = 0,
   REVIEW = 1,
+  REVIEW_COMPACT = 2,
+  ANSWERS = 3,  // load answer keys, no reply
+  RANK = 4,     // top_k follows, the next review also returns score counts
+};
+
+/**
+ * @brief Compact exam batch as received, before it is decoded
+ */
+struct EncodedBatch {
+  u64 exams = 0;                     /** Exams in the batch */
+  u64 answers = 0;                   /** Answers of every exam */
+  const std::string* data = nullptr; /** ExamCodec bytes, none if decoded */
 };
 
 struct MPIResult {
@@ -59,20 +96,71 @@ class MPICoordinator {
   void free_types();
   void send_exam_batch(const std::vector<MPIExam>& exams, int dest_rank,
                        int tag);
-  std::vector<MPIExam> receive_exam_batch(int source_rank, int tag);
+  void receive_exam_batch(int source_rank, int tag, ExamBatch& batch);
+  void send_compact_exam_batch(const std::vector<MPIExam>& exams,
+                               int dest_rank, int tag);
+  void receive_compact_exam_batch(int source_rank, int tag, ExamBatch& batch);
+  /**
+   * @brief Receive a compact batch without decoding it
+   * @return The batch, valid until the next compact batch is received
+   */
+  EncodedBatch receive_encoded_exam_batch(int source_rank, int tag);
   void send_answers(const std::string& answers, int dest_rank, int tag);
   std::string receive_answers(int source_rank, int tag);
-  void send_results(const std::vector<MPIResult>& results, int dest_rank,
+  void send_results(std::span<const MPIResult> results, int dest_rank,
                     int tag);
   std::vector<MPIResult> receive_results(int source_rank, int tag);
-  void send_to_workers(const json& exams_to_review, i32 mpi_size);
-  json receive_results_from_workers(i32 mpi_size);
-  std::pair<std::vector<MPIExam>, MPICommand> receive_from_master(
-      i32 master_rank);
-  void send_to_master(const std::vector<MPIResult>& results, i32 master_rank);
+  void send_analytics(const Analytics& analytics, int dest_rank, int tag);
+  void receive_analytics(int source_rank, int tag, Analytics& analytics);
+  void send_score_counts(std::span<const ScoreCount> counts, int dest_rank,
+                         int tag);
+  void receive_score_counts(int source_rank, int tag,
+                            std::vector<ScoreCount>& counts);
+  std::vector<MPIExam> parse_exams(const json& exams);
+  std::vector<std::vector<MPIExam>> slice_exams(
+      std::vector<MPIExam>&& exams, const std::vector<i32>& weights);
+  /**
+   * @brief Send a chunk with the keys of its stages taken from `answers`
+   */
+  void send_review(const std::vector<MPIExam>& exams,
+                   const AnswersSnapshot& answers, i32 worker_rank);
+  void send_rank_request(i32 top_k, i32 worker_rank);
+  std::optional<i32> probe_results(bool blocking);
+  std::vector<MPIResult> receive_from_worker(i32 worker_rank,
+                                             Analytics& analytics);
+  void receive_scores_from_worker(i32 worker_rank,
+                                  std::vector<ScoreCount>& counts);
+  /**
+   * @brief Wait for the next command of the master
+   * @param encoded If set, a compact batch is left undecoded there instead of
+   *                being decoded into `batch`
+   */
+  MPICommand receive_from_master(i32 master_rank, ExamBatch& batch,
+                                 i32& top_k,
+                                 EncodedBatch* encoded = nullptr);
+  void send_to_master(std::span<const MPIResult> results,
+                      const Analytics& analytics, i32 master_rank);
+  void send_scores_to_master(std::span<const ScoreCount> counts,
+                             i32 master_rank);
   void send_command(MPICommand command, i32 dest_rank, i32 tag);
   MPICommand receive_command(int source_rank, int tag);
-  void send_shutdown_signal(i32 mpi_size);
+  void send_shutdown_signal();
+  void send_answer_keys(i32 worker_rank);
+  const std::vector<i32>& workers() const;
+  i32 worker_weight(i32 worker_rank) const;
+  void use_node_leaders(const std::map<i32, i32>& node_sizes);
+  /**
+   * @brief Leave the ranks below `frontends` out of the workers
+   */
+  void use_frontends(i32 frontends);
+  /**
+   * @brief Start `count` workers and give them the answer keys
+   * @throws std::runtime_error if one of them fails, none of them is kept
+   */
+  std::vector<i32> spawn_workers(i32 count);
+  void retire_worker(i32 worker_rank);
+  i32 attach_to_parent(MPI_Comm parent);
+  void detach_from_master();
 
  private:
   MPICoordinator();
@@ -82,9 +170,31 @@ class MPICoordinator {
   MPI_Datatype _mpi_exam_header_type = MPI_DATATYPE_NULL;
   CoordinatorConfig _config;
   bool _types_created = false;
+  std::vector<i32> _workers;             // live workers (master only)
+  std::map<i32, i32> _weights;           // ranks behind a worker, default 1
+  std::map<i32, MPIEndpoint> _peers;     // peers outside MPI_COMM_WORLD
+  std::map<i32, MPI_Comm> _intercomms;   // intercomm of each spawned peer
+  i32 _next_worker_rank = 0;             // id given to the next spawned worker
+  std::string _encoded;                  // compact batch received, reused
 
-  std::vector<std::vector<MPIExam>> _slice_exams(const json& exams,
-                                                 i32 mpi_size);
+  MPIEndpoint _endpoint(i32 rank) const;
+  void _disconnect(i32 rank);
+  /**
+   * @brief Send `count` elements of `type` in pieces of at most
+   *        max_message_bytes, all of them in flight at once
+   * @return MPI_SUCCESS or the first error
+   */
+  i32 _send_pieces(const void* data, u64 count, MPI_Datatype type,
+                   u64 type_size, const MPIEndpoint& peer, i32 tag) const;
+  /**
+   * @brief Receive what _send_pieces() sent with the same count and type
+   */
+  i32 _receive_pieces(void* data, u64 count, MPI_Datatype type, u64 type_size,
+                      const MPIEndpoint& peer, i32 tag) const;
+  /**
+   * @throws std::runtime_error if `bytes` exceed max_batch_bytes
+   */
+  void _check_budget(u64 bytes, const char* what) const;
 };
 
 #endif  // COORDINATOR_HPP
\ No newline at end of file
@@ -1,9 +1,27 @@
 #include "evaluator.hpp"
+#include <algorithm>
 
 #include <domain/answers.hpp>
 
 std::unique_ptr<Evaluator> Evaluator::_instance = nullptr;
 
+namespace {
+
+/**
+ * @brief Set bits of each 32-bit lane of a word, in the same lane
+ */
+u64 lane_popcount(u64 word) {
+  word = word - ((word >> 1) & 0x5555555555555555u);
+  word = (word & 0x3333333333333333u) + ((word >> 2) & 0x3333333333333333u);
+  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Fu;
+  // the bytes of each lane add up in its low byte, at most 32
+  word = word + (word >> 8);
+  word = word + (word >> 16);
+  return word & 0x0000003F0000003Fu;
+}
+
+}  // namespace
+
 Evaluator& Evaluator::instance() {
   if (!_instance) {
     _instance.reset(new Evaluator());
@@ -11,50 +29,192 @@ Evaluator& Evaluator::instance() {
   return *_instance;
 }
 
-Evaluator::Evaluator() {
-  _scores = AnswersScores();
+void Evaluator::evaluate_exam_batch(const ExamBatch& exams,
+                                    std::vector<MPIResult>& results,
+                                    Analytics& analytics) {
+  auto answers = AnswersManager::instance().snapshot();
+  auto keys = answers->keys();
+  results.resize(exams.size());
+  analytics.reset(keys);
+  evaluate_exam_range(exams.view(), keys, 0, exams.size(), results,
+                      analytics);
 }
 
-std::vector<MPIResult> Evaluator::evaluate_exam_batch(
-    const std::vector<MPIExam>& exams) {
-  std::vector<MPIResult> results;
-  results.resize(exams.size());
-  for (size_t i = 0; i < exams.size(); i++) {
-    results[i] = _evaluate_exam(exams[i]);
+void Evaluator::evaluate_exam_range(const ExamBatchView& exams,
+                                    const AnswerKeys& keys, size_t begin,
+                                    size_t end, std::span<MPIResult> results,
+                                    Analytics& analytics) {
+  for (size_t i = begin; i < end; i++) {
+    auto exam = exams[i];
+    auto stage_index = keys.index(exam.stage);
+    if (!stage_index) {
+      results[i] = MPIResult{exam.stage,
+                             exam.id_exam,
+                             0,
+                             0,
+                             static_cast<i32>(exam.answers.size()),
+                             0.0};
+      continue;
+    }
+    const auto& entry = keys.stages[*stage_index];
+    auto correct_answers = keys.answers.subspan(entry.offset, entry.size);
+    auto weights = keys.weights.subspan(entry.offset, entry.size);
+    auto counters = analytics.questions(*stage_index);
+    results[i] = entry.multi_select
+                     ? _evaluate_policy<true>(exam, entry, correct_answers,
+                                              weights, counters)
+                     : _evaluate_policy<false>(exam, entry, correct_answers,
+                                               weights, counters);
+    analytics.add_exam(*stage_index, results[i].score,
+                       entry.total_weight * entry.scoring.correct);
   }
-  return results;
 }
 
-MPIResult Evaluator::_evaluate_exam(const MPIExam& exam) {
-  auto student_answers = exam.answers;
-  auto correct_answers = AnswersManager::instance().get_answers(exam.stage);
-  if (correct_answers.empty()) {
-    return MPIResult{exam.stage,
-                     exam.id_exam,
-                     0,
-                     0,
-                     static_cast<i32>(student_answers.size()),
-                     0.0};
+template <bool MultiSelect>
+MPIResult Evaluator::_evaluate_policy(const ExamView& exam,
+                                      const AnswerKeyEntry& entry,
+                                      std::span<const Answer> correct_answers,
+                                      std::span<const f64> weights,
+                                      std::span<i64> question_counters) {
+  switch (entry.policy) {
+    case ScoringPolicy::NO_PENALTY:
+      return _evaluate_exam<NoPenalty, MultiSelect>(
+          exam, entry, correct_answers, weights, question_counters);
+    case ScoringPolicy::UNIFORM:
+      return _evaluate_exam<UniformPenalty, MultiSelect>(
+          exam, entry, correct_answers, weights, question_counters);
+    case ScoringPolicy::WEIGHTED:
+      break;
   }
+  return _evaluate_exam<PerQuestionWeights, MultiSelect>(
+      exam, entry, correct_answers, weights, question_counters);
+}
+
+template <typename Policy, bool MultiSelect>
+MPIResult Evaluator::_evaluate_exam(const ExamView& exam,
+                                    const AnswerKeyEntry& entry,
+                                    std::span<const Answer> correct_answers,
+                                    std::span<const f64> weights,
+                                    std::span<i64> question_counters) {
+  const auto& scoring = entry.scoring;
   i32 correct_answers_count = 0;
   i32 wrong_answers_count = 0;
   i32 unscored_answers_count = 0;
-  for (auto& answer : student_answers) {
-    auto correct_answer_it = correct_answers.find(answer.qst_idx);
-    if (correct_answer_it == correct_answers.end()) {
+  f64 credits = 0.0;          // multi-select: credit of the answered questions
+  f64 points = 0.0;           // weighted points of the answered questions
+  f64 answered_weight = 0.0;  // weight of the answered questions
+  i32 answered_count = 0;     // answered questions, each counted once
+  if constexpr (Policy::penalties) {
+    _answered.assign((entry.size + 63) / 64, 0);
+  }
+  auto tally = [&](size_t question, f64 credit) {
+    i32 match = credit == 1.0;
+    if constexpr (MultiSelect) {
+      credits += credit;
+    }
+    correct_answers_count += match;
+    wrong_answers_count += 1 - match;
+    // answered and correct counters of the question, for the analytics
+    question_counters[2 * question]++;
+    question_counters[2 * question + 1] += match;
+    if constexpr (Policy::weighted) {
+      points += weights[question] *
+                (scoring.wrong + credit * (scoring.correct - scoring.wrong));
+    }
+    if constexpr (Policy::penalties) {
+      // a question answered twice is still only one question less blank
+      auto& word = _answered[question / 64];
+      const u64 bit = u64{1} << (question % 64);
+      if ((word & bit) == 0) {
+        word |= bit;
+        answered_count++;
+        if constexpr (Policy::weighted) {
+          answered_weight += weights[question];
+        }
+      }
+    }
+  };
+  if constexpr (MultiSelect) {
+    _selections.clear();
+  }
+  for (const auto& answer : exam.answers) {
+    auto correct_answer_it = std::lower_bound(
+        correct_answers.begin(), correct_answers.end(), answer.qst_idx,
+        [](const Answer& key, i32 qst_idx) { return key.qst_idx < qst_idx; });
+    if (correct_answer_it == correct_answers.end() ||
+        correct_answer_it->qst_idx != answer.qst_idx) {
       unscored_answers_count++;
       continue;
     }
-    if (correct_answer_it->second == answer.ans_idx) {
-      correct_answers_count++;
-    } else {
-      wrong_answers_count++;
+    auto question = static_cast<size_t>(correct_answer_it -
+                                        correct_answers.begin());
+    if constexpr (MultiSelect) {
+      if (correct_answer_it->rans_mask != 0) {
+        // scored below with the other selections of the exam
+        _selections.push_back({question, selected_options(answer.ans_idx),
+                               correct_answer_it->rans_mask, 0.0});
+        continue;
+      }
+    }
+    tally(question, correct_answer_it->rans_idx == answer.ans_idx);
+  }
+  if constexpr (MultiSelect) {
+    _credit_selections(scoring.multi_select);
+    for (const auto& selection : _selections) {
+      tally(selection.question, selection.credit);
     }
   }
-  double score = correct_answers_count * _scores.correct_answer +
-                 wrong_answers_count * _scores.wrong_answer +
-                 unscored_answers_count * _scores.unscored_answer;
+  f64 correct_points = correct_answers_count;
+  if constexpr (MultiSelect) {
+    correct_points = credits;
+  }
+  f64 score = correct_points * scoring.correct;
+  if constexpr (Policy::weighted) {
+    score = points +
+            std::max(entry.total_weight - answered_weight, 0.0) *
+                scoring.blank +
+            unscored_answers_count * scoring.unscored;
+  } else if constexpr (Policy::penalties) {
+    auto answered = correct_answers_count + wrong_answers_count;
+    auto blank_count =
+        std::max(static_cast<i32>(entry.size) - answered_count, 0);
+    score += (answered - correct_points) * scoring.wrong +
+             blank_count * scoring.blank +
+             unscored_answers_count * scoring.unscored;
+  }
   return MPIResult{
       exam.stage,          exam.id_exam,           correct_answers_count,
       wrong_answers_count, unscored_answers_count, score};
-}
\ No newline at end of file
+}
+
+void Evaluator::_credit_selections(MultiSelectRule rule) {
+  constexpr u64 LANE = 0xFFFFFFFFu;
+  // two selections per word, the low lane first
+  for (size_t i = 0; i < _selections.size(); i += 2) {
+    const size_t lanes = std::min<size_t>(_selections.size() - i, 2);
+    u64 picked = 0;
+    u64 correct = 0;
+    for (size_t lane = 0; lane < lanes; lane++) {
+      picked |= u64{_selections[i + lane].picked} << (32 * lane);
+      correct |= u64{_selections[i + lane].correct} << (32 * lane);
+    }
+    if (rule == MultiSelectRule::EXACT) {
+      auto differ = picked ^ correct;
+      for (size_t lane = 0; lane < lanes; lane++) {
+        _selections[i + lane].credit = ((differ >> (32 * lane)) & LANE) == 0;
+      }
+      continue;
+    }
+    auto hits = lane_popcount(picked & correct);
+    auto misses = lane_popcount(picked & ~correct);
+    auto options = lane_popcount(correct);
+    for (size_t lane = 0; lane < lanes; lane++) {
+      auto shift = 32 * lane;
+      auto right = static_cast<i32>((hits >> shift) & LANE);
+      auto wrong = static_cast<i32>((misses >> shift) & LANE);
+      _selections[i + lane].credit =
+          std::max(right - wrong, 0) /
+          static_cast<f64>((options >> shift) & LANE);
+    }
+  }
+}
@@ -2,30 +2,94 @@
 #ifndef EVALUATOR_HPP
 #define EVALUATOR_HPP
 
+#include <domain/analytics.hpp>
+#include <domain/answers.hpp>
 #include <domain/coordinator.hpp>
+#include <domain/exam_batch.hpp>
 #include <map>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <system/aliases.hpp>
+#include <vector>
 
-struct AnswersScores {
-  double correct_answer = +1.0;
-  double wrong_answer = 0.0;
-  double unscored_answer = 0.0;
+/**
+ * @brief Scoring policy shapes the evaluator kernel is specialized on
+ * @details Each shape only pays for what it uses: NoPenalty counts correct
+ *          answers, UniformPenalty adds the points of every outcome of the
+ *          stage, PerQuestionWeights also reads the weight of each answered
+ *          question. Stages with multi-select questions get a second variant
+ *          of each kernel that scores the bitmask selections of an exam
+ *          together, two questions per 64-bit word.
+ */
+struct NoPenalty {
+  static constexpr bool penalties = false;
+  static constexpr bool weighted = false;
+};
+
+struct UniformPenalty {
+  static constexpr bool penalties = true;
+  static constexpr bool weighted = false;
+};
+
+struct PerQuestionWeights {
+  static constexpr bool penalties = true;
+  static constexpr bool weighted = true;
 };
 
 class Evaluator {
  public:
   static Evaluator& instance();
   ~Evaluator() = default;
-  std::vector<MPIResult> evaluate_exam_batch(const std::vector<MPIExam>& exams);
+  void evaluate_exam_batch(const ExamBatch& exams,
+                           std::vector<MPIResult>& results,
+                           Analytics& analytics);
+  /**
+   * @brief Score exams [begin, end) of a batch
+   * @details `analytics` must have been reset with the same `keys`.
+   */
+  void evaluate_exam_range(const ExamBatchView& exams, const AnswerKeys& keys,
+                           size_t begin, size_t end,
+                           std::span<MPIResult> results, Analytics& analytics);
 
  private:
-  Evaluator();
+  Evaluator() = default;
   static std::unique_ptr<Evaluator> _instance;
-  AnswersScores _scores;
+  /** Questions of the exam being scored already answered, one bit each, so
+   *  the blank ones are counted right when an answer is repeated */
+  std::vector<u64> _answered;
+
+  /**
+   * @brief Multi-select answer of the exam being scored
+   */
+  struct Selection {
+    size_t question; /** Index of the question in the stage key */
+    u32 picked;      /** Options the student selected */
+    u32 correct;     /** Correct options of the question */
+    f64 credit;      /** 0 to 1, set by _credit_selections() */
+  };
+
+  /** Multi-select answers of the exam being scored */
+  std::vector<Selection> _selections;
+
+  /**
+   * @brief Credit every selection of the exam
+   * @details Two selections are packed in a 64-bit word and compared in one
+   *          go: EXACT xors the masks, PARTIAL counts the right and wrong
+   *          picks with a popcount of each 32-bit lane.
+   */
+  void _credit_selections(MultiSelectRule rule);
+
+  template <bool MultiSelect>
+  MPIResult _evaluate_policy(const ExamView& exam, const AnswerKeyEntry& entry,
+                             std::span<const Answer> correct_answers,
+                             std::span<const f64> weights,
+                             std::span<i64> question_counters);
 
-  MPIResult _evaluate_exam(const MPIExam& exam);
+  template <typename Policy, bool MultiSelect>
+  MPIResult _evaluate_exam(const ExamView& exam, const AnswerKeyEntry& entry,
+                           std::span<const Answer> correct_answers,
+                           std::span<const f64> weights,
+                           std::span<i64> question_counters);
 };
 
 #endif  // EVALUATOR_HPP
\ No newline at end of file
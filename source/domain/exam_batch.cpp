@@ -0,0 +1,19 @@
+#include "exam_batch.hpp"
+
+void ExamBatch::reset() {
+  _exams.clear();
+  _questions.clear();
+}
+
+void ExamBatch::reserve(size_t exams, size_t questions) {
+  _exams.reserve(exams);
+  _questions.reserve(questions);
+}
+
+MPIQuestion* ExamBatch::append(i32 stage, i32 id_exam, i32 answers_size) {
+  auto offset = _questions.size();
+  auto size = static_cast<size_t>(answers_size > 0 ? answers_size : 0);
+  _exams.push_back({stage, id_exam, offset, size});
+  _questions.resize(offset + size);
+  return _questions.data() + offset;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef EXAM_BATCH_HPP
+#define EXAM_BATCH_HPP
+
+#include <domain/coordinator.hpp>
+#include <span>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Read-only view of one exam stored in an ExamBatch
+ */
+struct ExamView {
+  i32 stage;                             /** Stage of the exam */
+  i32 id_exam;                           /** Exam identifier */
+  std::span<const MPIQuestion> answers;  /** Student answers */
+};
+
+/**
+ * @brief Exam entry of a batch, its answers live in the batch questions
+ */
+struct ExamSlot {
+  i32 stage;
+  i32 id_exam;
+  size_t offset;
+  size_t answers_size;
+};
+
+/**
+ * @brief Non-owning view of a batch laid out as slots plus flat questions
+ * @details Used to score a batch wherever it is stored, e.g. in an ExamBatch
+ *          or in a node shared-memory window.
+ */
+struct ExamBatchView {
+  std::span<const ExamSlot> exams;
+  std::span<const MPIQuestion> questions;
+
+  ExamView operator[](size_t index) const {
+    const auto& slot = exams[index];
+    return ExamView{slot.stage, slot.id_exam,
+                    questions.subspan(slot.offset, slot.answers_size)};
+  }
+
+  size_t size() const { return exams.size(); }
+};
+
+/**
+ * @brief Arena-backed batch of exams
+ * @details All the answers of the batch live in a single flat buffer and each
+ *          exam only records its slice of it. reset() drops the contents but
+ *          keeps the capacity, so a worker that reuses the same batch across
+ *          iterations stops allocating once it has seen its largest batch.
+ */
+class ExamBatch {
+ public:
+  /**
+   * @brief Drop every exam of the batch, keeping the allocated storage
+   */
+  void reset();
+
+  /**
+   * @brief Reserve storage for a batch
+   * @param exams Number of exams expected
+   * @param questions Total number of answers expected
+   */
+  void reserve(size_t exams, size_t questions);
+
+  /**
+   * @brief Append an exam to the batch
+   * @param stage Stage of the exam
+   * @param id_exam Exam identifier
+   * @param answers_size Number of answers of the exam
+   * @return Pointer to the (uninitialized) answers slot of the new exam. It is
+   *         only valid until the next call to append().
+   */
+  MPIQuestion* append(i32 stage, i32 id_exam, i32 answers_size);
+
+  /**
+   * @brief Get a view of the i-th exam of the batch
+   */
+  ExamView operator[](size_t index) const { return view()[index]; }
+
+  /**
+   * @brief Get a view of the whole batch
+   */
+  ExamBatchView view() const { return ExamBatchView{_exams, _questions}; }
+
+  size_t size() const { return _exams.size(); }
+
+  bool empty() const { return _exams.empty(); }
+
+ private:
+  std::vector<ExamSlot> _exams;        /** Exams of the batch */
+  std::vector<MPIQuestion> _questions; /** Flat answers storage */
+};
+
+#endif  // EXAM_BATCH_HPP
@@ -0,0 +1,209 @@
+#include "exam_codec.hpp"
+#include <bit>
+#include <stdexcept>
+
+#include <domain/answers.hpp>
+
+namespace {
+
+u32 zigzag(i32 value) {
+  return (static_cast<u32>(value) << 1) ^ static_cast<u32>(value >> 31);
+}
+
+i32 unzigzag(u32 value) {
+  return static_cast<i32>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+void put_varint(std::string& out, u32 value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/**
+ * @brief Bounds-checked reader over an encoded batch
+ */
+class Reader {
+ public:
+  explicit Reader(const std::string& data)
+      : _data(reinterpret_cast<const u8*>(data.data())),
+        _size(data.size()) {}
+
+  u8 byte() {
+    if (_pos >= _size) {
+      throw std::runtime_error("Malformed compact exam batch");
+    }
+    return _data[_pos++];
+  }
+
+  u32 varint() {
+    u32 value = 0;
+    for (u32 shift = 0; shift < 35; shift += 7) {
+      u8 current = byte();
+      value |= static_cast<u32>(current & 0x7F) << shift;
+      if ((current & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::runtime_error("Malformed compact exam batch");
+  }
+
+  i32 svarint() { return unzigzag(varint()); }
+
+  bool done() const { return _pos == _size; }
+
+ private:
+  const u8* _data;
+  size_t _size;
+  size_t _pos = 0;
+};
+
+}  // namespace
+
+void ExamCodec::encode(const std::vector<MPIExam>& exams, std::string& out) {
+  for (const auto& exam : exams) {
+    const auto& answers = exam.answers;
+    u8 flags = DENSE | NIBBLE;
+    for (size_t i = 0; i < answers.size(); i++) {
+      if (answers[i].qst_idx !=
+          static_cast<i64>(answers[0].qst_idx) + static_cast<i64>(i)) {
+        flags &= ~DENSE;
+      }
+      if (answers[i].ans_idx < 0 || answers[i].ans_idx > 0xF) {
+        flags &= ~NIBBLE;
+      }
+      if (answers[i].ans_idx < 0 || answers[i].ans_idx > 0xFF) {
+        flags |= WIDE;
+      }
+      if (static_cast<u32>(answers[i].ans_idx) & MULTI_SELECT_FLAG) {
+        flags |= MASKS;
+      }
+    }
+    put_varint(out, zigzag(exam.stage));
+    put_varint(out, zigzag(exam.id_exam));
+    put_varint(out, static_cast<u32>(answers.size()));
+    out.push_back(static_cast<char>(flags));
+    if (answers.empty()) {
+      continue;
+    }
+    if (flags & DENSE) {
+      put_varint(out, zigzag(answers[0].qst_idx));
+    } else {
+      i32 previous = 0;
+      for (const auto& answer : answers) {
+        auto delta =
+            static_cast<u32>(answer.qst_idx) - static_cast<u32>(previous);
+        put_varint(out, zigzag(static_cast<i32>(delta)));
+        previous = answer.qst_idx;
+      }
+    }
+    if (flags & NIBBLE) {
+      for (size_t i = 0; i < answers.size(); i += 2) {
+        u8 packed = static_cast<u8>(answers[i].ans_idx);
+        if (i + 1 < answers.size()) {
+          packed |= static_cast<u8>(answers[i + 1].ans_idx << 4);
+        }
+        out.push_back(static_cast<char>(packed));
+      }
+    } else if (flags & MASKS) {
+      for (const auto& answer : answers) {
+        put_varint(out, std::rotl(static_cast<u32>(answer.ans_idx), 1));
+      }
+    } else if (flags & WIDE) {
+      for (const auto& answer : answers) {
+        put_varint(out, zigzag(answer.ans_idx));
+      }
+    } else {
+      for (const auto& answer : answers) {
+        out.push_back(static_cast<char>(answer.ans_idx));
+      }
+    }
+  }
+}
+
+template <typename Append>
+void ExamCodec::_decode(const std::string& data, u64 exams_size,
+                        Append&& append) {
+  Reader reader(data);
+  for (u64 i = 0; i < exams_size; i++) {
+    i32 stage = reader.svarint();
+    i32 id_exam = reader.svarint();
+    u32 answers_size = reader.varint();
+    u8 flags = reader.byte();
+    // every answer takes at least half a byte, reject sizes the buffer can't
+    // hold before allocating for them
+    if (answers_size > data.size() * 2) {
+      throw std::runtime_error("Malformed compact exam batch");
+    }
+    MPIQuestion* answers = append(stage, id_exam, answers_size);
+    if (answers_size == 0) {
+      continue;
+    }
+    if (flags & DENSE) {
+      auto first = static_cast<u32>(reader.svarint());
+      for (u32 j = 0; j < answers_size; j++) {
+        answers[j].qst_idx = static_cast<i32>(first + j);
+      }
+    } else {
+      i32 previous = 0;
+      for (u32 j = 0; j < answers_size; j++) {
+        previous = static_cast<i32>(static_cast<u32>(previous) +
+                                    static_cast<u32>(reader.svarint()));
+        answers[j].qst_idx = previous;
+      }
+    }
+    if (flags & NIBBLE) {
+      for (u32 j = 0; j < answers_size; j += 2) {
+        u8 packed = reader.byte();
+        answers[j].ans_idx = packed & 0xF;
+        if (j + 1 < answers_size) {
+          answers[j + 1].ans_idx = packed >> 4;
+        }
+      }
+    } else if (flags & MASKS) {
+      for (u32 j = 0; j < answers_size; j++) {
+        answers[j].ans_idx = static_cast<i32>(std::rotr(reader.varint(), 1));
+      }
+    } else if (flags & WIDE) {
+      for (u32 j = 0; j < answers_size; j++) {
+        answers[j].ans_idx = reader.svarint();
+      }
+    } else {
+      for (u32 j = 0; j < answers_size; j++) {
+        answers[j].ans_idx = reader.byte();
+      }
+    }
+  }
+  if (!reader.done()) {
+    throw std::runtime_error("Malformed compact exam batch");
+  }
+}
+
+void ExamCodec::decode(const std::string& data, i32 exams_size,
+                       ExamBatch& batch) {
+  batch.reset();
+  batch.reserve(exams_size, 0);
+  _decode(data, exams_size, [&batch](i32 stage, i32 id_exam, u32 size) {
+    return batch.append(stage, id_exam, static_cast<i32>(size));
+  });
+}
+
+void ExamCodec::decode(const std::string& data, std::span<ExamSlot> exams,
+                       std::span<MPIQuestion> questions) {
+  size_t index = 0;
+  size_t offset = 0;
+  _decode(data, exams.size(), [&](i32 stage, i32 id_exam, u32 size) {
+    if (size > questions.size() - offset) {
+      throw std::runtime_error("Malformed compact exam batch");
+    }
+    exams[index++] = ExamSlot{stage, id_exam, offset, size};
+    auto* answers = questions.data() + offset;
+    offset += size;
+    return answers;
+  });
+  if (offset != questions.size()) {
+    throw std::runtime_error("Malformed compact exam batch");
+  }
+}
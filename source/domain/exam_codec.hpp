@@ -0,0 +1,75 @@
+#pragma once
+#ifndef EXAM_CODEC_HPP
+#define EXAM_CODEC_HPP
+
+#include <domain/coordinator.hpp>
+#include <domain/exam_batch.hpp>
+#include <span>
+#include <string>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Compact wire encoding for exam batches
+ * @details Every exam is encoded as:
+ *          - stage, id_exam (zigzag varints), answers_size (varint), flags (u8)
+ *          - DENSE: the first qst_idx (zigzag varint); the rest are implicit
+ *            (first + i). Otherwise every qst_idx is sent as a zigzag varint
+ *            delta from the previous one.
+ *          - NIBBLE: ans_idx packed two per byte (values 0..15).
+ *            MASKS: ans_idx rotated left by one bit as varints, so a
+ *            multi-select mask costs a byte per 7 options and a single
+ *            option index a byte up to 63.
+ *            WIDE: ans_idx as zigzag varints (values outside 0..255).
+ *            Otherwise one u8 per ans_idx.
+ *          A dense exam with small option indexes costs about half a byte per
+ *          answer instead of the 8 bytes of MPIQuestion.
+ */
+class ExamCodec {
+ public:
+  ExamCodec() = delete;   // prevent instantiation
+  ~ExamCodec() = delete;  // prevent instantiation
+
+  /**
+   * @brief Encode a batch of exams
+   * @param exams Exams to encode
+   * @param out Output buffer, the encoded batch is appended to it
+   */
+  static void encode(const std::vector<MPIExam>& exams, std::string& out);
+
+  /**
+   * @brief Decode an encoded batch straight into an ExamBatch
+   * @param data Encoded batch
+   * @param exams_size Number of exams in the encoded batch
+   * @param batch Batch to fill (reset before decoding)
+   * @throw std::runtime_error If the data is malformed
+   */
+  static void decode(const std::string& data, i32 exams_size,
+                     ExamBatch& batch);
+
+  /**
+   * @brief Decode an encoded batch into storage laid out by the caller
+   * @param exams One slot per exam of the batch
+   * @param questions Exactly the answers of every exam
+   * @throw std::runtime_error If the data is malformed or does not fill
+   *        `questions`
+   */
+  static void decode(const std::string& data, std::span<ExamSlot> exams,
+                     std::span<MPIQuestion> questions);
+
+ private:
+  static constexpr u8 DENSE = 1 << 0;  /** qst_idx are first, first + 1, ... */
+  static constexpr u8 NIBBLE = 1 << 1; /** ans_idx packed two per byte */
+  static constexpr u8 WIDE = 1 << 2;   /** ans_idx sent as varints */
+  static constexpr u8 MASKS = 1 << 3;  /** ans_idx with multi-select masks */
+
+  /**
+   * @brief Decode `exams_size` exams, `append(stage, id_exam, answers_size)`
+   *        returns where the answers of each one go
+   */
+  template <typename Append>
+  static void _decode(const std::string& data, u64 exams_size,
+                      Append&& append);
+};
+
+#endif  // EXAM_CODEC_HPP
@@ -0,0 +1,352 @@
+#include "node.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <domain/answers.hpp>
+#include <domain/evaluator.hpp>
+#include <domain/exam_codec.hpp>
+#include <mutex>
+#include <stdexcept>
+
+std::unique_ptr<NodeGroup> NodeGroup::_instance = nullptr;
+
+namespace {
+
+/**
+ * @brief Count or displacement of a node collective, MPI takes them as int
+ * @throw std::runtime_error If it does not fit
+ */
+i32 collective_count(size_t count) {
+  if (count > static_cast<size_t>(std::numeric_limits<i32>::max())) {
+    throw std::runtime_error("Failed to share the batch with the node");
+  }
+  return static_cast<i32>(count);
+}
+
+}  // namespace
+
+u8* SharedWindow::reserve(MPI_Comm comm, size_t bytes, bool owner) {
+  if (bytes <= _capacity) {
+    return _data;
+  }
+  free();
+  // grow geometrically so a slowly growing batch doesn't reallocate each time
+  _capacity = std::max({bytes, _capacity + _capacity / 2, size_t{4096}});
+  void* base = nullptr;
+  auto alloc_result = MPI_Win_allocate_shared(
+      owner ? static_cast<MPI_Aint>(_capacity) : 0, 1, MPI_INFO_NULL, comm,
+      &base, &_win);
+  if (alloc_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to allocate shared window");
+  }
+  if (!owner) {
+    MPI_Aint size = 0;
+    i32 disp_unit = 0;
+    auto query_result = MPI_Win_shared_query(_win, 0, &size, &disp_unit, &base);
+    if (query_result != MPI_SUCCESS) {
+      throw std::runtime_error("Failed to query shared window");
+    }
+  }
+  _data = static_cast<u8*>(base);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, _win);
+  return _data;
+}
+
+void SharedWindow::sync(MPI_Comm comm) {
+  MPI_Win_sync(_win);
+  MPI_Barrier(comm);
+  MPI_Win_sync(_win);
+}
+
+void SharedWindow::free() {
+  if (_win == MPI_WIN_NULL) {
+    return;
+  }
+  MPI_Win_unlock_all(_win);
+  MPI_Win_free(&_win);
+  _data = nullptr;
+  _capacity = 0;
+}
+
+NodeGroup& NodeGroup::instance() {
+  static std::once_flag flag;
+  std::call_once(flag, []() { _instance.reset(new NodeGroup()); });
+  return *_instance;
+}
+
+void NodeGroup::setup(NodeMode mode, i32 frontends) {
+  _mode = mode;
+  if (!enabled()) {
+    return;
+  }
+  i32 rank = 0;
+  i32 size = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  // the master and the other front-ends are left out of the node groups
+  const bool worker = rank >= frontends;
+  MPI_Comm_split(MPI_COMM_WORLD, worker ? 0 : MPI_UNDEFINED, rank,
+                 &_workers_comm);
+  i32 info[] = {0, 0};  // is leader, ranks on the node
+  if (worker) {
+    MPI_Comm_split_type(_workers_comm, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &_node_comm);
+    MPI_Comm_rank(_node_comm, &_node_rank);
+    MPI_Comm_size(_node_comm, &_node_size);
+    info[0] = leader() ? 1 : 0;
+    info[1] = _node_size;
+  }
+  std::vector<i32> all_info(rank == 0 ? 2 * size : 0);
+  MPI_Gather(info, 2, MPI_INT, all_info.data(), 2, MPI_INT, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    for (i32 i = frontends; i < size; i++) {
+      if (all_info[2 * i] == 1) {
+        _node_sizes[i] = all_info[2 * i + 1];
+      }
+    }
+    spdlog::info("Node {} mode: {} nodes",
+                 _mode == NodeMode::SHARED ? "shared" : "tree",
+                 _node_sizes.size());
+  }
+}
+
+std::span<const MPIResult> NodeGroup::review(const ExamBatch& exams,
+                                             const EncodedBatch& encoded) {
+  if (encoded.data != nullptr && !decodes()) {
+    throw std::runtime_error("Only a shared node decodes compact batches");
+  }
+  _answers = AnswersManager::instance().snapshot();
+  auto keys = _answers->keys();
+  auto batch = exams.view();
+  const bool decoded = encoded.data == nullptr;
+  NodeTask task{static_cast<u8>(MPICommand::REVIEW),
+                decoded ? batch.exams.size() : encoded.exams,
+                decoded ? batch.questions.size() : encoded.answers,
+                keys.stages.size(), keys.answers.size()};
+  if (_mode == NodeMode::TREE) {
+    // checked before the siblings are involved, the largest byte counts of
+    // the collectives bound every share
+    collective_count(task.exams *
+                     std::max(sizeof(ExamSlot), sizeof(MPIResult)));
+    collective_count(task.questions * sizeof(MPIQuestion));
+    collective_count(task.key_stages * sizeof(AnswerKeyEntry));
+    collective_count(task.key_answers * std::max(sizeof(Answer), sizeof(f64)));
+  }
+  MPI_Bcast(&task, sizeof(task), MPI_BYTE, 0, _node_comm);
+  if (_mode == NodeMode::TREE) {
+    return _review_tree(exams, task);
+  }
+  return _review_shared(exams, encoded, task);
+}
+
+bool NodeGroup::serve() {
+  NodeTask task;
+  MPI_Bcast(&task, sizeof(task), MPI_BYTE, 0, _node_comm);
+  if (static_cast<MPICommand>(task.command) == MPICommand::SHUTDOWN) {
+    _window.free();
+    return false;
+  }
+  if (_mode == NodeMode::TREE) {
+    _serve_tree(task);
+    return true;
+  }
+  auto* base = _window.reserve(_node_comm, _layout(task).size, false);
+  _window.sync(_node_comm);
+  _score(task, base);
+  return true;
+}
+
+void NodeGroup::shutdown() {
+  if (!enabled() || !leader()) {
+    return;
+  }
+  NodeTask task{static_cast<u8>(MPICommand::SHUTDOWN), 0, 0, 0, 0};
+  MPI_Bcast(&task, sizeof(task), MPI_BYTE, 0, _node_comm);
+  _window.free();
+}
+
+NodeGroup::Layout NodeGroup::_layout(const NodeTask& task) {
+  auto align = [](size_t offset) { return (offset + 63) & ~size_t{63}; };
+  Layout layout;
+  layout.key_stages = 0;
+  layout.key_answers =
+      align(layout.key_stages + task.key_stages * sizeof(AnswerKeyEntry));
+  layout.key_weights =
+      align(layout.key_answers + task.key_answers * sizeof(Answer));
+  layout.exams = align(layout.key_weights + task.key_answers * sizeof(f64));
+  layout.questions = align(layout.exams + task.exams * sizeof(ExamSlot));
+  layout.results =
+      align(layout.questions + task.questions * sizeof(MPIQuestion));
+  layout.size = layout.results + task.exams * sizeof(MPIResult);
+  return layout;
+}
+
+std::span<const MPIResult> NodeGroup::_score(const NodeTask& task, u8* base) {
+  auto layout = _layout(task);
+  ExamBatchView batch{
+      {reinterpret_cast<const ExamSlot*>(base + layout.exams), task.exams},
+      {reinterpret_cast<const MPIQuestion*>(base + layout.questions),
+       task.questions}};
+  AnswerKeys keys{
+      {reinterpret_cast<const AnswerKeyEntry*>(base + layout.key_stages),
+       task.key_stages},
+      {reinterpret_cast<const Answer*>(base + layout.key_answers),
+       task.key_answers},
+      {reinterpret_cast<const f64*>(base + layout.key_weights),
+       task.key_answers}};
+  std::span<MPIResult> results{
+      reinterpret_cast<MPIResult*>(base + layout.results), task.exams};
+  auto [begin, end] = _share(task.exams, _node_rank);
+  _analytics.reset(keys);
+  Evaluator::instance().evaluate_exam_range(batch, keys, begin, end, results,
+                                            _analytics);
+  _analytics.reduce(_node_comm, 0);
+  _window.sync(_node_comm);
+  return results;
+}
+
+std::span<const MPIResult> NodeGroup::_review_shared(
+    const ExamBatch& exams, const EncodedBatch& encoded,
+    const NodeTask& task) {
+  auto layout = _layout(task);
+  auto capacity = _window.capacity();
+  auto* base = _window.reserve(_node_comm, layout.size, true);
+  if (_window.capacity() != capacity) {
+    _window_keys.reset();  // a new window, nothing in it yet
+  }
+  // the keys sit at the start of the window, unchanged keys stay there
+  if (_window_keys != _answers->version()) {
+    auto keys = _answers->keys();
+    std::memcpy(base + layout.key_stages, keys.stages.data(),
+                keys.stages.size_bytes());
+    std::memcpy(base + layout.key_answers, keys.answers.data(),
+                keys.answers.size_bytes());
+    std::memcpy(base + layout.key_weights, keys.weights.data(),
+                keys.weights.size_bytes());
+    _window_keys = _answers->version();
+  }
+  if (encoded.data != nullptr) {
+    ExamCodec::decode(
+        *encoded.data,
+        {reinterpret_cast<ExamSlot*>(base + layout.exams), task.exams},
+        {reinterpret_cast<MPIQuestion*>(base + layout.questions),
+         task.questions});
+  } else {
+    auto batch = exams.view();
+    std::memcpy(base + layout.exams, batch.exams.data(),
+                batch.exams.size_bytes());
+    std::memcpy(base + layout.questions, batch.questions.data(),
+                batch.questions.size_bytes());
+  }
+  _window.sync(_node_comm);
+  return _score(task, base);
+}
+
+std::span<const MPIResult> NodeGroup::_review_tree(const ExamBatch& exams,
+                                                   const NodeTask& task) {
+  auto keys = _broadcast_keys(task);
+  auto batch = exams.view();
+  // byte counts and displacements of the share of every rank
+  std::vector<i32> slot_counts(_node_size), slot_displs(_node_size);
+  std::vector<i32> question_counts(_node_size), question_displs(_node_size);
+  std::vector<i32> result_counts(_node_size), result_displs(_node_size);
+  for (i32 rank = 0; rank < _node_size; rank++) {
+    auto [begin, end] = _share(task.exams, rank);
+    size_t first = 0;
+    size_t last = 0;
+    if (begin < end) {
+      first = batch.exams[begin].offset;
+      last = batch.exams[end - 1].offset + batch.exams[end - 1].answers_size;
+    }
+    slot_counts[rank] = collective_count((end - begin) * sizeof(ExamSlot));
+    slot_displs[rank] = collective_count(begin * sizeof(ExamSlot));
+    question_counts[rank] =
+        collective_count((last - first) * sizeof(MPIQuestion));
+    question_displs[rank] = collective_count(first * sizeof(MPIQuestion));
+    result_counts[rank] = collective_count((end - begin) * sizeof(MPIResult));
+    result_displs[rank] = collective_count(begin * sizeof(MPIResult));
+  }
+  MPI_Scatter(question_counts.data(), 1, MPI_INT, MPI_IN_PLACE, 1, MPI_INT, 0,
+              _node_comm);
+  MPI_Scatterv(batch.exams.data(), slot_counts.data(), slot_displs.data(),
+               MPI_BYTE, MPI_IN_PLACE, 0, MPI_BYTE, 0, _node_comm);
+  MPI_Scatterv(batch.questions.data(), question_counts.data(),
+               question_displs.data(), MPI_BYTE, MPI_IN_PLACE, 0, MPI_BYTE, 0,
+               _node_comm);
+  // the leader scores the first share straight from the batch
+  _results.resize(task.exams);
+  auto [begin, end] = _share(task.exams, 0);
+  _analytics.reset(keys);
+  Evaluator::instance().evaluate_exam_range(batch, keys, begin, end, _results,
+                                            _analytics);
+  MPI_Gatherv(MPI_IN_PLACE, 0, MPI_BYTE, _results.data(), result_counts.data(),
+              result_displs.data(), MPI_BYTE, 0, _node_comm);
+  _analytics.reduce(_node_comm, 0);
+  return _results;
+}
+
+void NodeGroup::_serve_tree(const NodeTask& task) {
+  auto keys = _broadcast_keys(task);
+  auto [begin, end] = _share(task.exams, _node_rank);
+  i32 question_bytes = 0;
+  MPI_Scatter(nullptr, 1, MPI_INT, &question_bytes, 1, MPI_INT, 0,
+              _node_comm);
+  _exams.resize(end - begin);
+  _questions.resize(question_bytes / sizeof(MPIQuestion));
+  MPI_Scatterv(nullptr, nullptr, nullptr, MPI_BYTE, _exams.data(),
+               collective_count(_exams.size() * sizeof(ExamSlot)), MPI_BYTE, 0,
+               _node_comm);
+  MPI_Scatterv(nullptr, nullptr, nullptr, MPI_BYTE, _questions.data(),
+               question_bytes, MPI_BYTE, 0, _node_comm);
+  // slots still point into the questions of the whole batch
+  if (!_exams.empty()) {
+    auto first = _exams.front().offset;
+    for (auto& slot : _exams) {
+      slot.offset -= first;
+    }
+  }
+  _results.resize(_exams.size());
+  _analytics.reset(keys);
+  Evaluator::instance().evaluate_exam_range(ExamBatchView{_exams, _questions},
+                                            keys, 0, _exams.size(), _results,
+                                            _analytics);
+  MPI_Gatherv(_results.data(),
+              collective_count(_results.size() * sizeof(MPIResult)), MPI_BYTE,
+              nullptr, nullptr, nullptr, MPI_BYTE, 0, _node_comm);
+  _analytics.reduce(_node_comm, 0);
+}
+
+AnswerKeys NodeGroup::_broadcast_keys(const NodeTask& task) {
+  if (leader()) {
+    auto keys = _answers->keys();
+    MPI_Bcast(const_cast<AnswerKeyEntry*>(keys.stages.data()),
+              collective_count(keys.stages.size_bytes()), MPI_BYTE, 0,
+              _node_comm);
+    MPI_Bcast(const_cast<Answer*>(keys.answers.data()),
+              collective_count(keys.answers.size_bytes()), MPI_BYTE, 0,
+              _node_comm);
+    MPI_Bcast(const_cast<f64*>(keys.weights.data()),
+              collective_count(keys.weights.size()), MPI_DOUBLE, 0,
+              _node_comm);
+    return keys;
+  }
+  _key_stages.resize(task.key_stages);
+  _key_answers.resize(task.key_answers);
+  _key_weights.resize(task.key_answers);
+  MPI_Bcast(_key_stages.data(),
+            collective_count(_key_stages.size() * sizeof(AnswerKeyEntry)),
+            MPI_BYTE, 0, _node_comm);
+  MPI_Bcast(_key_answers.data(),
+            collective_count(_key_answers.size() * sizeof(Answer)), MPI_BYTE,
+            0, _node_comm);
+  MPI_Bcast(_key_weights.data(), collective_count(_key_weights.size()),
+            MPI_DOUBLE, 0, _node_comm);
+  return AnswerKeys{_key_stages, _key_answers, _key_weights};
+}
+
+std::pair<size_t, size_t> NodeGroup::_share(size_t exams,
+                                            i32 node_rank) const {
+  // each rank of the node scores a contiguous share of the batch
+  return {exams * node_rank / _node_size, exams * (node_rank + 1) / _node_size};
+}
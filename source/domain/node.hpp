@@ -0,0 +1,189 @@
+#pragma once
+#ifndef NODE_HPP
+#define NODE_HPP
+
+#include <mpi.h>
+#include <domain/analytics.hpp>
+#include <domain/answers.hpp>
+#include <domain/coordinator.hpp>
+#include <domain/exam_batch.hpp>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system/aliases.hpp>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Node-local shared-memory window
+ * @details Wraps MPI_Win_allocate_shared. Only the owner (node rank 0)
+ *          contributes memory, every other rank maps it. The window only
+ *          grows, so once it fits the largest batch it is reused as is.
+ */
+class SharedWindow {
+ public:
+  /**
+   * @brief Make sure the window holds at least `bytes` bytes
+   * @details Collective over `comm`, every rank must ask for the same size.
+   * @return Base address of the window on this rank
+   */
+  u8* reserve(MPI_Comm comm, size_t bytes, bool owner);
+
+  /**
+   * @brief Make the writes of the owner visible to the rest of the node
+   * @details Collective over `comm` (memory sync plus barrier).
+   */
+  void sync(MPI_Comm comm);
+
+  /**
+   * @brief Release the window, collective over the node
+   */
+  void free();
+
+  size_t capacity() const { return _capacity; }
+
+ private:
+  MPI_Win _win = MPI_WIN_NULL;
+  u8* _data = nullptr;
+  size_t _capacity = 0;
+};
+
+/**
+ * @brief How the ranks of a node share the work of their leader
+ */
+enum class NodeMode : u8 {
+  OFF = 0,    /** Every worker talks to the master */
+  SHARED = 1, /** Batches and keys published in a shared-memory window */
+  TREE = 2,   /** Batches scattered and results gathered by the leader */
+};
+
+/**
+ * @brief Work descriptor broadcast by the node leader to its siblings
+ */
+struct NodeTask {
+  u8 command;      /** MPICommand */
+  u64 exams;       /** Exams in the batch */
+  u64 questions;   /** Answers in the batch */
+  u64 key_stages;  /** Stages in the answer keys */
+  u64 key_answers; /** Answers in the answer keys */
+};
+
+/**
+ * @brief Ranks sharing a node
+ * @details Workers on the same node are grouped with
+ *          MPI_Comm_split_type(MPI_COMM_TYPE_SHARED). Only the node leader
+ *          talks to the master: it receives the answer keys and the exam batch
+ *          of the whole node, so the master fans out to nodes, not ranks.
+ *          - SHARED: the leader publishes them in a shared window and every
+ *            rank of the node scores its share from there, writing the
+ *            results into the same window.
+ *          - TREE: the leader broadcasts the keys, scatters a contiguous share
+ *            of the batch to every rank and gathers the results back.
+ *          Either way the leader then sends the node results to the master.
+ */
+class NodeGroup {
+ public:
+  static NodeGroup& instance();
+  ~NodeGroup() = default;
+
+  /**
+   * @brief Group the workers by node
+   * @param mode How the node shares the work, OFF disables grouping
+   * @param frontends Ranks left out of the groups, they serve clients
+   * @details Collective over MPI_COMM_WORLD, every rank started by mpirun
+   *          must call it with the same `mode` and `frontends`.
+   */
+  void setup(NodeMode mode, i32 frontends = 1);
+
+  bool enabled() const { return _mode != NodeMode::OFF; }
+
+  bool leader() const { return _node_rank == 0; }
+
+  /**
+   * @brief Whether review() takes a compact batch undecoded (SHARED only)
+   */
+  bool decodes() const { return _mode == NodeMode::SHARED; }
+
+  /**
+   * @brief Node leaders and the number of ranks on their node (master only)
+   */
+  const std::map<i32, i32>& node_sizes() const { return _node_sizes; }
+
+  /**
+   * @brief Score a batch with the whole node (leader only)
+   * @param encoded The batch as received, decoded straight into the shared
+   *                window when set; `exams` is used otherwise
+   * @return Results of the batch, they live in the shared window (or the
+   *         gather buffer) and are valid until the next review
+   */
+  std::span<const MPIResult> review(const ExamBatch& exams,
+                                    const EncodedBatch& encoded = {});
+
+  /**
+   * @brief Aggregates of the last review, summed over the node (leader only)
+   */
+  const Analytics& analytics() const { return _analytics; }
+
+  /**
+   * @brief Serve the node leader (siblings only)
+   * @return False once the leader shuts the node down
+   */
+  bool serve();
+
+  /**
+   * @brief Shut the siblings down (leader only)
+   */
+  void shutdown();
+
+ private:
+  /**
+   * @brief Byte offsets of each section in the shared window
+   * @details The keys come first, so they stay in place from one batch to
+   *          the next.
+   */
+  struct Layout {
+    size_t key_stages;
+    size_t key_answers;
+    size_t key_weights;
+    size_t exams;
+    size_t questions;
+    size_t results;
+    size_t size;
+  };
+
+  NodeGroup() = default;
+  static std::unique_ptr<NodeGroup> _instance;
+  NodeMode _mode = NodeMode::OFF;
+  MPI_Comm _workers_comm = MPI_COMM_NULL;
+  MPI_Comm _node_comm = MPI_COMM_NULL;
+  i32 _node_rank = 0;
+  i32 _node_size = 1;
+  std::map<i32, i32> _node_sizes;
+  SharedWindow _window;
+  // TREE buffers, reused across batches
+  std::vector<ExamSlot> _exams;
+  std::vector<MPIQuestion> _questions;
+  std::vector<AnswerKeyEntry> _key_stages;
+  std::vector<Answer> _key_answers;
+  std::vector<f64> _key_weights;
+  std::vector<MPIResult> _results;
+  Analytics _analytics;
+  /** Keys of the review in progress (leader only) */
+  std::shared_ptr<const AnswersSnapshot> _answers;
+  /** Version of the keys in the shared window, none if it holds none */
+  std::optional<u64> _window_keys;
+
+  static Layout _layout(const NodeTask& task);
+  std::span<const MPIResult> _score(const NodeTask& task, u8* base);
+  std::span<const MPIResult> _review_shared(const ExamBatch& exams,
+                                            const EncodedBatch& encoded,
+                                            const NodeTask& task);
+  std::span<const MPIResult> _review_tree(const ExamBatch& exams,
+                                          const NodeTask& task);
+  void _serve_tree(const NodeTask& task);
+  AnswerKeys _broadcast_keys(const NodeTask& task);
+  std::pair<size_t, size_t> _share(size_t exams, i32 node_rank) const;
+};
+
+#endif  // NODE_HPP
@@ -0,0 +1,146 @@
+#include "ranking.hpp"
+#include <algorithm>
+
+namespace {
+
+/** Stage ascending, then score descending */
+bool before(i32 stage_a, f64 score_a, i32 stage_b, f64 score_b) {
+  return stage_a != stage_b ? stage_a < stage_b : score_a > score_b;
+}
+
+bool better(const MPIResult& a, const MPIResult& b) {
+  if (a.stage != b.stage || a.score != b.score) {
+    return before(a.stage, a.score, b.stage, b.score);
+  }
+  return a.id_exam < b.id_exam;
+}
+
+/**
+ * @brief Exams above each histogram entry and exams of each entry's stage
+ */
+struct Standing {
+  std::vector<i64> above;
+  std::vector<i64> stage_total;
+};
+
+Standing standing(std::span<const ScoreCount> counts) {
+  Standing result{std::vector<i64>(counts.size()),
+                  std::vector<i64>(counts.size())};
+  size_t first = 0;
+  while (first < counts.size()) {
+    size_t last = first;
+    i64 above = 0;
+    while (last < counts.size() && counts[last].stage == counts[first].stage) {
+      result.above[last] = above;
+      above += counts[last].count;
+      last++;
+    }
+    std::fill(result.stage_total.begin() + first,
+              result.stage_total.begin() + last, above);
+    first = last;
+  }
+  return result;
+}
+
+json ranked(const MPIResult& result, std::span<const ScoreCount> counts,
+            const Standing& table) {
+  json entry = result;
+  auto it = std::lower_bound(counts.begin(), counts.end(), result,
+                             [](const ScoreCount& count, const MPIResult& r) {
+                               return before(count.stage, count.score, r.stage,
+                                             r.score);
+                             });
+  if (it == counts.end() || it->stage != result.stage ||
+      it->score != result.score) {
+    return entry;  // not in the histogram, leave it unranked
+  }
+  auto index = static_cast<size_t>(it - counts.begin());
+  auto total = table.stage_total[index];
+  auto below = total - table.above[index] - it->count;
+  entry["rank"] = table.above[index] + 1;
+  entry["percentile"] = 100.0 * static_cast<f64>(below) / total;
+  return entry;
+}
+
+}  // namespace
+
+void Ranking::count_scores(std::span<const MPIResult> results,
+                           std::vector<ScoreCount>& counts) {
+  counts.clear();
+  counts.reserve(results.size());
+  for (const auto& result : results) {
+    counts.push_back({result.stage, 1, result.score});
+  }
+  merge_counts(counts, {});
+}
+
+void Ranking::merge_counts(std::vector<ScoreCount>& total,
+                           std::span<const ScoreCount> counts) {
+  total.insert(total.end(), counts.begin(), counts.end());
+  std::sort(total.begin(), total.end(),
+            [](const ScoreCount& a, const ScoreCount& b) {
+              return before(a.stage, a.score, b.stage, b.score);
+            });
+  size_t out = 0;
+  for (size_t i = 0; i < total.size(); i++) {
+    if (out > 0 && total[out - 1].stage == total[i].stage &&
+        total[out - 1].score == total[i].score) {
+      total[out - 1].count += total[i].count;
+    } else {
+      total[out++] = total[i];
+    }
+  }
+  total.resize(out);
+}
+
+void Ranking::select_top(std::span<const MPIResult> results, i32 top_k,
+                         std::vector<MPIResult>& selected) {
+  selected.assign(results.begin(), results.end());
+  std::sort(selected.begin(), selected.end(), better);
+  size_t out = 0;
+  i32 kept = 0;
+  for (size_t i = 0; i < selected.size(); i++) {
+    if (i == 0 || selected[i].stage != selected[i - 1].stage) {
+      kept = 0;
+    }
+    if (kept < top_k) {
+      selected[out++] = selected[i];
+      kept++;
+    }
+  }
+  selected.resize(out);
+}
+
+json Ranking::rank(std::span<const MPIResult> results,
+                   std::span<const ScoreCount> counts) {
+  auto table = standing(counts);
+  json ranked_results = json::array();
+  for (const auto& result : results) {
+    ranked_results.push_back(ranked(result, counts, table));
+  }
+  return ranked_results;
+}
+
+json Ranking::top(std::span<const MPIResult> results, i32 top_k,
+                  std::span<const ScoreCount> counts) {
+  std::vector<MPIResult> selected;
+  select_top(results, top_k, selected);
+  auto table = standing(counts);
+  json stages = json::array();
+  for (size_t i = 0; i < counts.size(); i++) {
+    if (i > 0 && counts[i].stage == counts[i - 1].stage) {
+      continue;
+    }
+    auto stage = counts[i].stage;
+    json top_results = json::array();
+    for (const auto& result : selected) {
+      if (result.stage == stage) {
+        top_results.push_back(ranked(result, counts, table));
+      }
+    }
+    stages.push_back({{"stage", stage},
+                      {"exams", table.stage_total[i]},
+                      {"top", top_results}});
+  }
+  return json{{"stages", stages}};
+}
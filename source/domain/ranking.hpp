@@ -0,0 +1,74 @@
+#pragma once
+#ifndef RANKING_HPP
+#define RANKING_HPP
+
+#include <domain/coordinator.hpp>
+#include <nlohmann/json.hpp>
+#include <span>
+#include <system/aliases.hpp>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * @brief Number of exams of a stage that got a given score
+ */
+struct ScoreCount {
+  i32 stage;
+  i32 count;
+  f64 score;
+};
+
+/**
+ * @brief Ranking of review results within their stage
+ * @details Scores are discrete, so every worker reduces its results to an
+ *          exact histogram of (stage, score) counts. Merging the histograms
+ *          gives, for any score, how many exams of the stage are above and
+ *          below it, so ranks and percentiles never need the full result set
+ *          in one place. Top-K works the same way: the best K of each stage
+ *          are among the best K of some worker.
+ *          Exams are ordered by decreasing score, then by id_exam. The rank
+ *          is 1 + the number of exams of the stage with a higher score, the
+ *          percentile is the share of the stage with a lower score.
+ */
+class Ranking {
+ public:
+  Ranking() = delete;
+  ~Ranking() = delete;
+
+  /**
+   * @brief Build the score histogram of a set of results
+   * @param counts Sorted by stage, then by decreasing score
+   */
+  static void count_scores(std::span<const MPIResult> results,
+                           std::vector<ScoreCount>& counts);
+
+  /**
+   * @brief Add a histogram into another one, keeping the order
+   */
+  static void merge_counts(std::vector<ScoreCount>& total,
+                           std::span<const ScoreCount> counts);
+
+  /**
+   * @brief Keep the `top_k` best results of each stage
+   * @param selected Sorted by stage, then best first
+   */
+  static void select_top(std::span<const MPIResult> results, i32 top_k,
+                         std::vector<MPIResult>& selected);
+
+  /**
+   * @brief Results with their rank and percentile, in the same order
+   * @param counts Histogram of every exam of the stages involved
+   */
+  static json rank(std::span<const MPIResult> results,
+                   std::span<const ScoreCount> counts);
+
+  /**
+   * @brief Best `top_k` results of each stage with their rank and percentile
+   * @return {"stages": [{"stage", "exams", "top": [...]}, ...]}
+   */
+  static json top(std::span<const MPIResult> results, i32 top_k,
+                  std::span<const ScoreCount> counts);
+};
+
+#endif  // RANKING_HPP
@@ -0,0 +1,186 @@
+#include "result_store.hpp"
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+std::unique_ptr<ResultStore> ResultStore::_instance = nullptr;
+
+ResultStore& ResultStore::instance() {
+  static std::once_flag flag;
+  std::call_once(flag, []() { _instance.reset(new ResultStore()); });
+  return *_instance;
+}
+
+ResultStore::~ResultStore() {
+  if (_data != nullptr) {
+    munmap(_data, _capacity);
+  }
+  if (_fd != -1) {
+    close(_fd);
+  }
+}
+
+void ResultStore::open(const std::string& path) {
+  _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (_fd == -1) {
+    throw std::runtime_error("Failed to open " + path + ": " +
+                             strerror(errno));
+  }
+  try {
+    _map(path);
+  } catch (std::exception&) {
+    if (_data != nullptr) {
+      munmap(_data, _capacity);
+      _data = nullptr;
+    }
+    close(_fd);
+    _fd = -1;
+    throw;
+  }
+  auto& header = _header();
+  auto fits = (_capacity - sizeof(Header)) / sizeof(MPIResult);
+  if (header.count > fits) {
+    spdlog::warn("Result store {} is truncated, keeping {} of {} results",
+                 path, fits, header.count);
+    header.count = fits;
+  }
+  for (u64 position = 0; position < header.count; position++) {
+    const auto& result = _record(position);
+    _index[{result.stage, result.id_exam}] = position;
+  }
+  spdlog::info("Result store {}: {} results of {} exams", path, header.count,
+               _index.size());
+}
+
+void ResultStore::_map(const std::string& path) {
+  struct stat file_stat;
+  if (fstat(_fd, &file_stat) == -1) {
+    throw std::runtime_error("Failed to stat " + path + ": " +
+                             strerror(errno));
+  }
+  auto size = static_cast<size_t>(file_stat.st_size);
+  const bool created = size == 0;
+  if (!created && size < sizeof(Header)) {
+    throw std::runtime_error(path + " is not a result store");
+  }
+  _capacity = std::max(size, sizeof(Header) + INITIAL_RECORDS *
+                                                   sizeof(MPIResult));
+  if (_capacity > size && ftruncate(_fd, _capacity) == -1) {
+    throw std::runtime_error("Failed to grow " + path + ": " +
+                             strerror(errno));
+  }
+  auto* mapped =
+      mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map " + path + ": " +
+                             strerror(errno));
+  }
+  _data = static_cast<u8*>(mapped);
+  auto& header = _header();
+  if (created) {
+    std::memcpy(header.magic, RESULT_STORE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(MPIResult);
+    header.count = 0;
+  } else if (std::memcmp(header.magic, RESULT_STORE_MAGIC,
+                         sizeof(header.magic)) != 0) {
+    throw std::runtime_error(path + " is not a result store");
+  } else if (header.record_size != sizeof(MPIResult)) {
+    throw std::runtime_error(path + " holds records of " +
+                             std::to_string(header.record_size) +
+                             " bytes, expected " +
+                             std::to_string(sizeof(MPIResult)));
+  }
+}
+
+void ResultStore::append(std::span<const MPIResult> results) {
+  if (!enabled() || results.empty()) {
+    return;
+  }
+  auto count = _header().count;
+  try {
+    _reserve(count + results.size());
+  } catch (std::exception& e) {
+    // the review itself succeeded, only its copy is lost
+    spdlog::error("Failed to store {} results: {}", results.size(), e.what());
+    return;
+  }
+  auto offset = sizeof(Header) + count * sizeof(MPIResult);
+  std::memcpy(_data + offset, results.data(), results.size_bytes());
+  // commit only once the records are on the disk
+  if (!_sync(offset, results.size_bytes())) {
+    spdlog::error("Failed to store {} results: {}", results.size(),
+                  strerror(errno));
+    return;
+  }
+  _header().count = count + results.size();
+  if (!_sync(0, sizeof(Header))) {
+    spdlog::error("Failed to commit {} results: {}", results.size(),
+                  strerror(errno));
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    _index[{results[i].stage, results[i].id_exam}] = count + i;
+  }
+}
+
+std::optional<MPIResult> ResultStore::find(i32 stage, i32 id_exam) const {
+  auto it = _index.find({stage, id_exam});
+  if (it == _index.end()) {
+    return std::nullopt;
+  }
+  return _record(it->second);
+}
+
+std::vector<MPIResult> ResultStore::page(i32 stage, std::optional<i32> after,
+                                         size_t limit) const {
+  auto it = after ? _index.upper_bound({stage, *after})
+                  : _index.lower_bound(
+                        {stage, std::numeric_limits<i32>::min()});
+  std::vector<MPIResult> results;
+  while (it != _index.end() && it->first.first == stage &&
+         results.size() < limit) {
+    results.push_back(_record(it->second));
+    ++it;
+  }
+  return results;
+}
+
+std::vector<MPIResult> ResultStore::stage(i32 stage) const {
+  return page(stage, std::nullopt, std::numeric_limits<size_t>::max());
+}
+
+const MPIResult& ResultStore::_record(u64 position) const {
+  return reinterpret_cast<const MPIResult*>(_data + sizeof(Header))[position];
+}
+
+bool ResultStore::_sync(size_t offset, size_t size) const {
+  // msync takes a page-aligned start
+  static const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto start = offset / page * page;
+  return msync(_data + start, offset + size - start, MS_SYNC) == 0;
+}
+
+void ResultStore::_reserve(u64 records) {
+  auto needed = sizeof(Header) + records * sizeof(MPIResult);
+  if (needed <= _capacity) {
+    return;
+  }
+  auto capacity = std::max(needed, _capacity * 2);
+  if (ftruncate(_fd, capacity) == -1) {
+    throw std::runtime_error("Failed to grow the result store: " +
+                             std::string(strerror(errno)));
+  }
+  auto* mapped = mremap(_data, _capacity, capacity, MREMAP_MAYMOVE);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map the result store: " +
+                             std::string(strerror(errno)));
+  }
+  _data = static_cast<u8*>(mapped);
+  _capacity = capacity;
+}
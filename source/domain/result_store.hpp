@@ -0,0 +1,114 @@
+#pragma once
+#ifndef RESULT_STORE_HPP
+#define RESULT_STORE_HPP
+
+#include <domain/coordinator.hpp>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <system/aliases.hpp>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Append-only log of review results on the master
+ * @details The log is a memory-mapped file: a header (RESULT_STORE_MAGIC, the
+ *          record size and the number of committed records) followed by
+ *          MPIResult records in native byte order. Results are copied into
+ *          the mapping and synced to the file, only then counted in the
+ *          header, which is synced in turn, so a crash never exposes a
+ *          partial record. A log written with another record size is
+ *          refused. The file grows by
+ *          doubling. A result reviewed again is appended again and the
+ *          newest one wins, the index on (stage, id_exam) is rebuilt from the
+ *          log when the store is opened.
+ *          Only the thread that runs the scheduler uses the store.
+ */
+class ResultStore {
+ public:
+  static constexpr char RESULT_STORE_MAGIC[8] = {'S', 'H', 'R', 'S',
+                                                 '0', '0', '0', '2'};
+
+  static ResultStore& instance();
+  ~ResultStore();
+
+  /**
+   * @brief Open or create the log and index it
+   * @throws std::runtime_error if the file cannot be mapped or is not a log
+   */
+  void open(const std::string& path);
+
+  bool enabled() const { return _data != nullptr; }
+
+  /**
+   * @brief Append results, no-op when the store is not open
+   * @details A failure to grow the log is logged, the results are dropped.
+   */
+  void append(std::span<const MPIResult> results);
+
+  /**
+   * @brief Latest result of an exam
+   */
+  std::optional<MPIResult> find(i32 stage, i32 id_exam) const;
+
+  /**
+   * @brief Results of a stage by id_exam, starting after `after`
+   * @param after Last id_exam of the previous page, none for the first page
+   * @param limit Results in the page
+   */
+  std::vector<MPIResult> page(i32 stage, std::optional<i32> after,
+                              size_t limit) const;
+
+  /**
+   * @brief Every result of a stage, by id_exam
+   */
+  std::vector<MPIResult> stage(i32 stage) const;
+
+  /**
+   * @brief Exams with a result
+   */
+  size_t exams() const { return _index.size(); }
+
+ private:
+  /**
+   * @brief Start of the file
+   */
+  struct Header {
+    char magic[8];
+    u64 record_size; /** sizeof(MPIResult) of the writer */
+    u64 count;       /** Records committed */
+  };
+
+  static constexpr u64 INITIAL_RECORDS = 4096;
+
+  ResultStore() = default;
+  static std::unique_ptr<ResultStore> _instance;
+  i32 _fd = -1;
+  u8* _data = nullptr;
+  size_t _capacity = 0; /** Bytes mapped, the size of the file */
+  /** Record of the latest result of each (stage, id_exam) */
+  std::map<std::pair<i32, i32>, u64> _index;
+
+  Header& _header() const { return *reinterpret_cast<Header*>(_data); }
+  const MPIResult& _record(u64 position) const;
+
+  /**
+   * @brief Write the mapped bytes [offset, offset + size) back to the file
+   */
+  bool _sync(size_t offset, size_t size) const;
+
+  /**
+   * @brief Size the file, map it and check or write its header
+   * @throws std::runtime_error if it cannot be mapped or is not a log
+   */
+  void _map(const std::string& path);
+
+  /**
+   * @brief Grow the file and the mapping to hold `records` records
+   */
+  void _reserve(u64 records);
+};
+
+#endif  // RESULT_STORE_HPP
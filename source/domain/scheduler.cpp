@@ -0,0 +1,396 @@
+#include "scheduler.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <domain/answers.hpp>
+#include <domain/evaluator.hpp>
+#include <domain/result_store.hpp>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+std::unique_ptr<Scheduler> Scheduler::_instance = nullptr;
+
+Scheduler& Scheduler::instance() {
+  static std::once_flag flag;
+  std::call_once(flag, []() { _instance.reset(new Scheduler()); });
+  return *_instance;
+}
+
+void Scheduler::set_config(const SchedulerConfig& config) {
+  _config = config;
+}
+
+void Scheduler::set_preemption(std::function<void(Priority)> hook) {
+  _preemption = std::move(hook);
+}
+
+json Scheduler::review(const json& exams, Priority priority) {
+  json results_json =
+      review(MPICoordinator::instance().parse_exams(exams), priority);
+  return results_json;
+}
+
+std::vector<MPIResult> Scheduler::review(std::vector<MPIExam> exams,
+                                         Priority priority) {
+  auto exams_size = exams.size();
+  auto chunks = _run(std::move(exams), false, 0, priority);
+  std::vector<MPIResult> results;
+  results.reserve(exams_size);
+  for (const auto& chunk : chunks) {
+    results.insert(results.end(), chunk->results.begin(),
+                   chunk->results.end());
+  }
+  ResultStore::instance().append(results);
+  return results;
+}
+
+json Scheduler::rank(const json& exams, i32 top_k, Priority priority) {
+  if (top_k < 0) {
+    throw std::runtime_error("Invalid top_k");
+  }
+  std::vector<ScoreCount> counts;
+  auto results = rank(MPICoordinator::instance().parse_exams(exams), top_k,
+                      priority, counts);
+  if (top_k == 0) {
+    return Ranking::rank(results, counts);
+  }
+  return Ranking::top(results, top_k, counts);
+}
+
+std::vector<MPIResult> Scheduler::rank(std::vector<MPIExam> exams, i32 top_k,
+                                       Priority priority,
+                                       std::vector<ScoreCount>& counts) {
+  if (top_k < 0) {
+    throw std::runtime_error("Invalid top_k");
+  }
+  auto chunks = _run(std::move(exams), true, top_k, priority);
+  std::vector<MPIResult> results;
+  counts.clear();
+  for (const auto& chunk : chunks) {
+    results.insert(results.end(), chunk->results.begin(),
+                   chunk->results.end());
+    Ranking::merge_counts(counts, chunk->counts);
+  }
+  if (top_k == 0) {
+    ResultStore::instance().append(results);
+    return results;
+  }
+  // each chunk kept its own top_k
+  std::vector<MPIResult> selected;
+  Ranking::select_top(results, top_k, selected);
+  return selected;
+}
+
+std::vector<std::shared_ptr<Scheduler::Chunk>> Scheduler::_run(
+    std::vector<MPIExam> exams, bool ranked, i32 top_k, Priority priority) {
+  auto& coordinator = MPICoordinator::instance();
+  Job job{priority, {}, 0};
+  if (exams.empty()) {
+    return job.chunks;
+  }
+  // every chunk is scored with the keys of the moment the review started,
+  // even if they are replaced or patched while it runs
+  auto answers = AnswersManager::instance().snapshot();
+  if (_score_here(exams)) {
+    auto chunk = std::make_shared<Chunk>();
+    chunk->exams = std::move(exams);
+    chunk->ranked = ranked;
+    chunk->top_k = top_k;
+    chunk->answers = answers;
+    _score_locally(*chunk);
+    job.chunks.push_back(chunk);
+    return job.chunks;
+  }
+  // pick up duplicates of previous reviews that are already back
+  while (_collect(false)) {
+  }
+  // one round gives every live worker a chunk sized after its ranks, large
+  // reviews take several rounds so workers free up between them
+  std::vector<i32> round;
+  for (auto worker_rank : coordinator.workers()) {
+    if (!_retiring.contains(worker_rank)) {
+      round.push_back(coordinator.worker_weight(worker_rank));
+    }
+  }
+  auto round_exams = size_t{std::max(_config.max_chunk_exams, 1u)} *
+                     std::accumulate(round.begin(), round.end(), size_t{0});
+  auto rounds =
+      std::max<size_t>((exams.size() + round_exams - 1) / round_exams, 1);
+  std::vector<i32> weights;
+  weights.reserve(round.size() * rounds);
+  for (size_t i = 0; i < rounds; i++) {
+    weights.insert(weights.end(), round.begin(), round.end());
+  }
+  auto slices = coordinator.slice_exams(std::move(exams), weights);
+  job.chunks.reserve(slices.size());
+  for (auto& slice : slices) {
+    if (slice.empty()) {
+      continue;
+    }
+    auto chunk = std::make_shared<Chunk>();
+    chunk->exams = std::move(slice);
+    chunk->ranked = ranked;
+    chunk->top_k = top_k;
+    chunk->answers = answers;
+    job.chunks.push_back(chunk);
+  }
+  auto pending = [&job]() {
+    return std::any_of(job.chunks.begin(), job.chunks.end(),
+                       [](const auto& chunk) { return !chunk->done; });
+  };
+  _jobs.push_back(&job);
+  try {
+    while (pending()) {
+      _dispatch_pending();
+      if (_collect(false)) {
+        continue;
+      }
+      _redispatch_late(job.chunks);
+      if (_preemption) {
+        _preemption(priority);
+      }
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(_config.poll_interval_us));
+    }
+  } catch (...) {
+    std::erase(_jobs, &job);
+    throw;
+  }
+  std::erase(_jobs, &job);
+  return job.chunks;
+}
+
+void Scheduler::drain() {
+  auto outstanding = [this]() {
+    return std::any_of(_assignments.begin(), _assignments.end(),
+                       [](const auto& entry) { return !entry.second.empty(); });
+  };
+  while (outstanding()) {
+    _collect(true);
+  }
+}
+
+json Scheduler::analytics() {
+  _refresh_analytics();
+  return _analytics.to_json();
+}
+
+void Scheduler::reset_analytics() {
+  _analytics_stale = true;
+}
+
+size_t Scheduler::add_workers(i32 count) {
+  if (count <= 0) {
+    throw std::runtime_error("Invalid workers count");
+  }
+  auto& coordinator = MPICoordinator::instance();
+  coordinator.spawn_workers(count);
+  return coordinator.workers().size();
+}
+
+size_t Scheduler::remove_workers(i32 count) {
+  auto& coordinator = MPICoordinator::instance();
+  auto workers = coordinator.workers();
+  if (count <= 0) {
+    throw std::runtime_error("Invalid workers count");
+  }
+  if (count >= static_cast<i32>(workers.size())) {
+    throw std::runtime_error("Cannot remove all the workers");
+  }
+  std::vector<i32> retired(workers.end() - count, workers.end());
+  _retiring.insert(retired.begin(), retired.end());
+  auto outstanding = [this, &retired]() {
+    return std::any_of(retired.begin(), retired.end(), [this](i32 rank) {
+      auto it = _assignments.find(rank);
+      return it != _assignments.end() && !it->second.empty();
+    });
+  };
+  while (outstanding()) {
+    _collect(true);
+  }
+  for (auto worker_rank : retired) {
+    coordinator.retire_worker(worker_rank);
+    _assignments.erase(worker_rank);
+    _retiring.erase(worker_rank);
+    spdlog::info("Retired worker {}", worker_rank);
+  }
+  return coordinator.workers().size();
+}
+
+bool Scheduler::scores_locally(u64 exams) const {
+  if (MPICoordinator::instance().workers().empty()) {
+    return true;
+  }
+  // either limit at 0 turns it off, even for reviews without answers
+  return _config.local_max_exams > 0 && _config.local_max_answers > 0 &&
+         exams <= _config.local_max_exams;
+}
+
+bool Scheduler::_score_here(const std::vector<MPIExam>& exams) const {
+  if (!scores_locally(exams.size())) {
+    return false;
+  }
+  if (MPICoordinator::instance().workers().empty()) {
+    return true;
+  }
+  u64 answers = 0;
+  for (const auto& exam : exams) {
+    answers += exam.answers.size();
+  }
+  return answers <= _config.local_max_answers;
+}
+
+void Scheduler::_score_locally(Chunk& chunk) {
+  _local_batch.reset();
+  for (const auto& exam : chunk.exams) {
+    auto* answers = _local_batch.append(
+        exam.stage, exam.id_exam, static_cast<i32>(exam.answers.size()));
+    std::copy(exam.answers.begin(), exam.answers.end(), answers);
+  }
+  // the same steps as a worker and _collect(), without the round trip
+  auto keys = chunk.answers->keys();
+  chunk.results.resize(_local_batch.size());
+  _partial.reset(keys);
+  Evaluator::instance().evaluate_exam_range(_local_batch.view(), keys, 0,
+                                            _local_batch.size(),
+                                            chunk.results, _partial);
+  if (chunk.ranked) {
+    Ranking::count_scores(chunk.results, chunk.counts);
+    if (chunk.top_k > 0) {
+      std::vector<MPIResult> selected;
+      Ranking::select_top(chunk.results, chunk.top_k, selected);
+      chunk.results = std::move(selected);
+    }
+  }
+  chunk.done = true;
+  _refresh_analytics();
+  _analytics.merge(_partial);
+}
+
+std::vector<i32> Scheduler::_idle_workers() const {
+  std::vector<i32> idle;
+  for (auto rank : MPICoordinator::instance().workers()) {
+    if (_retiring.contains(rank)) {
+      continue;
+    }
+    auto it = _assignments.find(rank);
+    if (it == _assignments.end() || it->second.empty()) {
+      idle.push_back(rank);
+    }
+  }
+  return idle;
+}
+
+void Scheduler::_dispatch_pending() {
+  auto idle = _idle_workers();
+  auto worker = idle.begin();
+  // strict priority, then the order the reviews started in
+  for (size_t level = 0; level < PRIORITY_CLASSES; level++) {
+    for (auto* job : _jobs) {
+      if (static_cast<size_t>(job->priority) != level) {
+        continue;
+      }
+      while (job->next < job->chunks.size() && worker != idle.end()) {
+        _dispatch(job->chunks[job->next++], *worker++);
+      }
+    }
+  }
+}
+
+void Scheduler::_dispatch(const std::shared_ptr<Chunk>& chunk,
+                          i32 worker_rank) {
+  auto& coordinator = MPICoordinator::instance();
+  if (chunk->ranked) {
+    coordinator.send_rank_request(chunk->top_k, worker_rank);
+  }
+  coordinator.send_review(chunk->exams, *chunk->answers, worker_rank);
+  auto now = clock::now();
+  chunk->last_dispatch = now;
+  chunk->last_weight = coordinator.worker_weight(worker_rank);
+  chunk->dispatches++;
+  _assignments[worker_rank].push_back({chunk, now, chunk->last_weight});
+}
+
+bool Scheduler::_collect(bool blocking) {
+  auto& coordinator = MPICoordinator::instance();
+  auto worker_rank = coordinator.probe_results(blocking);
+  if (!worker_rank) {
+    return false;
+  }
+  auto results = coordinator.receive_from_worker(*worker_rank, _partial);
+  auto& queue = _assignments[*worker_rank];
+  if (queue.empty()) {
+    spdlog::error("Unexpected results from worker {}", *worker_rank);
+    return true;
+  }
+  // workers answer their chunks in order
+  auto assignment = std::move(queue.front());
+  queue.pop_front();
+  auto& chunk = *assignment.chunk;
+  if (chunk.ranked) {
+    coordinator.receive_scores_from_worker(*worker_rank, _partial_counts);
+  }
+  if (chunk.done) {
+    spdlog::debug("Discarding duplicate results from worker {}",
+                  *worker_rank);
+    return true;
+  }
+  chunk.done = true;
+  chunk.results = std::move(results);
+  if (chunk.ranked) {
+    chunk.counts = std::move(_partial_counts);
+  }
+  _refresh_analytics();
+  _analytics.merge(_partial);
+  std::chrono::duration<double> elapsed = clock::now() - assignment.sent_at;
+  // seconds per exam of a single rank, a node of N ranks goes N times faster
+  auto sample = elapsed.count() * assignment.weight /
+                static_cast<double>(chunk.exams.size());
+  _seconds_per_exam =
+      _seconds_per_exam == 0.0
+          ? sample
+          : _config.throughput_alpha * sample +
+                (1.0 - _config.throughput_alpha) * _seconds_per_exam;
+  return true;
+}
+
+void Scheduler::_redispatch_late(
+    const std::vector<std::shared_ptr<Chunk>>& chunks) {
+  if (_seconds_per_exam == 0.0) {
+    return;  // no throughput observed yet, nothing to compare against
+  }
+  auto now = clock::now();
+  for (const auto& chunk : chunks) {
+    if (chunk->done || chunk->dispatches == 0 ||
+        chunk->dispatches >= _config.max_dispatches) {
+      continue;
+    }
+    std::chrono::duration<double> expected(
+        _config.straggler_factor * _seconds_per_exam *
+        static_cast<double>(chunk->exams.size()) / chunk->last_weight);
+    auto deadline = chunk->last_dispatch +
+                    std::max(std::chrono::duration_cast<clock::duration>(
+                                 expected),
+                             std::chrono::duration_cast<clock::duration>(
+                                 std::chrono::milliseconds(
+                                     _config.straggler_min_wait_ms)));
+    if (now < deadline) {
+      continue;
+    }
+    auto idle = _idle_workers();
+    if (idle.empty()) {
+      return;
+    }
+    spdlog::warn("Chunk of {} exams is late, re-dispatching to worker {}",
+                 chunk->exams.size(), idle.front());
+    _dispatch(chunk, idle.front());
+  }
+}
+
+void Scheduler::_refresh_analytics() {
+  if (!_analytics_stale) {
+    return;
+  }
+  _analytics.reset(AnswersManager::instance().snapshot()->keys());
+  _analytics_stale = false;
+}
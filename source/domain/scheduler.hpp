@@ -0,0 +1,229 @@
+#pragma once
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <chrono>
+#include <deque>
+#include <domain/analytics.hpp>
+#include <domain/coordinator.hpp>
+#include <domain/exam_batch.hpp>
+#include <domain/ranking.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <system/aliases.hpp>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+ * @brief Priority class of a review, HIGH goes first
+ */
+enum class Priority : u8 {
+  HIGH = 0,   /** Interactive, e.g. a student checking a result */
+  NORMAL = 1, /** Default */
+  LOW = 2,    /** Bulk, e.g. a regrade */
+};
+
+static constexpr size_t PRIORITY_CLASSES = 3;
+
+NLOHMANN_JSON_SERIALIZE_ENUM(Priority, {{Priority::NORMAL, "normal"},
+                                        {Priority::HIGH, "high"},
+                                        {Priority::LOW, "low"}})
+
+/**
+ * @brief Scheduler configuration
+ */
+struct SchedulerConfig {
+  double straggler_factor = 3.0;  /** Deadline, in multiples of expected time */
+  u32 straggler_min_wait_ms = 50; /** Never re-dispatch a chunk before this */
+  u32 max_dispatches = 2;         /** Copies of one chunk allowed in flight */
+  u32 poll_interval_us = 100;     /** Sleep between polls of the workers */
+  double throughput_alpha = 0.2;  /** Weight of the newest throughput sample */
+  u32 max_chunk_exams = 1024;     /** Exams per chunk and rank of the worker */
+  u32 local_max_exams = 32;       /** Largest review scored on the master */
+  u64 local_max_answers = 4096;   /** Its answers at most; either 0: never */
+};
+
+/**
+ * @brief Master-side scheduler of REVIEW work
+ * @details Splits a review into chunks, sends them to idle workers and polls
+ *          for results instead of blocking on every rank. Each chunk gets a
+ *          deadline derived from the observed throughput (seconds per exam);
+ *          a chunk that misses it is re-dispatched to an idle worker, the
+ *          first result that arrives wins and the duplicate is discarded,
+ *          even if it shows up during a later review.
+ *          Large reviews are cut into several rounds of chunks, handed out as
+ *          workers free up. While a review waits on the workers the preemption
+ *          hook may start a review of a higher priority; the chunks of every
+ *          running review are handed out in strict priority order, so the
+ *          higher one only waits for the chunks already in flight.
+ *          A review within local_max_exams and local_max_answers is scored
+ *          on the master with the Evaluator instead, a round trip to the
+ *          workers would cost more than the review. So is every review when
+ *          there are no workers, e.g. a single-rank deployment.
+ */
+class Scheduler {
+ public:
+  static Scheduler& instance();
+  ~Scheduler() = default;
+  void set_config(const SchedulerConfig& config);
+
+  /**
+   * @brief Set the hook called while a review waits on the workers
+   * @details The hook gets the priority of the waiting review and may run
+   *          reviews of a strictly higher priority before returning.
+   */
+  void set_preemption(std::function<void(Priority)> hook);
+
+  /**
+   * @brief Review a batch of exams on the workers
+   * @param exams Exams to review (JSON array)
+   * @return Results in the same order as the exams
+   * @details The results are also appended to the ResultStore, if open,
+   *          before they are returned.
+   */
+  json review(const json& exams, Priority priority = Priority::NORMAL);
+
+  /**
+   * @brief Review a batch of already parsed exams on the workers
+   * @return Results in the same order as the exams
+   */
+  std::vector<MPIResult> review(std::vector<MPIExam> exams,
+                                Priority priority = Priority::NORMAL);
+
+  /**
+   * @brief Review a batch of exams and rank them within their stage
+   * @param exams Exams to review (JSON array)
+   * @param top_k Best exams kept per stage, 0 to rank every exam
+   * @return With top_k 0, the results in the same order as the exams with
+   *         their rank and percentile; otherwise the best top_k of each stage
+   *         (see Ranking::top). Workers only send back their own top_k.
+   * @details With top_k 0 the results are appended to the ResultStore, a
+   *          top_k selection is partial and is not stored.
+   */
+  json rank(const json& exams, i32 top_k,
+            Priority priority = Priority::NORMAL);
+
+  /**
+   * @brief Rank a batch of already parsed exams
+   * @param counts Score histogram of every exam of the stages involved
+   * @return With top_k 0, the results in the same order as the exams;
+   *         otherwise the best top_k of each stage. Ranking::rank() or
+   *         Ranking::top() with `counts` writes the JSON of rank() above.
+   */
+  std::vector<MPIResult> rank(std::vector<MPIExam> exams, i32 top_k,
+                              Priority priority,
+                              std::vector<ScoreCount>& counts);
+
+  /**
+   * @brief Spawn new workers and add them to the live set
+   * @param count Number of workers to spawn
+   * @return Number of live workers
+   */
+  size_t add_workers(i32 count);
+
+  /**
+   * @brief Retire workers from the live set
+   * @param count Number of workers to retire
+   * @return Number of live workers
+   * @details The newest workers are retired first. They get no new chunks,
+   *          their outstanding chunks are drained and then they are shut down.
+   *          At least one worker is always kept.
+   */
+  size_t remove_workers(i32 count);
+
+  /**
+   * @brief Wait for every outstanding (duplicate) chunk to come back
+   * @details Must be called before shutting the workers down, so that none of
+   *          them is left blocked on sending results nobody receives.
+   */
+  void drain();
+
+  /**
+   * @brief Per-stage and per-question totals of the reviews so far
+   * @details Built from the partial aggregates the workers send with their
+   *          results; duplicates of re-dispatched chunks are not counted.
+   */
+  json analytics();
+
+  /**
+   * @brief Start the totals over, e.g. after the answer keys changed
+   */
+  void reset_analytics();
+
+  /**
+   * @brief Whether a review of `exams` exams may be scored on the master
+   * @details Always when there are no workers. Otherwise only its size is
+   *          looked at here, its answers may still send it to the workers.
+   */
+  bool scores_locally(u64 exams) const;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Slice of a review sent to one or more workers
+   */
+  struct Chunk {
+    std::vector<MPIExam> exams;
+    std::vector<MPIResult> results;
+    clock::time_point last_dispatch;
+    i32 last_weight = 1; /** Ranks behind the worker of the last dispatch */
+    u32 dispatches = 0;
+    bool done = false;
+    bool ranked = false;             /** Workers also send score counts */
+    i32 top_k = 0;                   /** Results kept per stage, 0 for all */
+    std::vector<ScoreCount> counts;  /** Score histogram of the chunk */
+    std::shared_ptr<const AnswersSnapshot> answers; /** Keys of the review */
+  };
+
+  /**
+   * @brief Review being run, its chunks are handed out in order
+   */
+  struct Job {
+    Priority priority;
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t next = 0; /** First chunk never dispatched */
+  };
+
+  /**
+   * @brief Chunk sent to a worker and the time it was sent
+   */
+  struct Assignment {
+    std::shared_ptr<Chunk> chunk;
+    clock::time_point sent_at;
+    i32 weight; /** Ranks behind the worker */
+  };
+
+  Scheduler() = default;
+  static std::unique_ptr<Scheduler> _instance;
+  SchedulerConfig _config;
+  /** Chunks sent to each worker, in the order they will be answered */
+  std::map<i32, std::deque<Assignment>> _assignments;
+  double _seconds_per_exam = 0.0; /** Observed throughput, 0 if unknown */
+  std::set<i32> _retiring;        /** Workers being drained */
+  Analytics _analytics;           /** Totals of the accepted chunks */
+  Analytics _partial;             /** Aggregates of the last results */
+  std::vector<ScoreCount> _partial_counts; /** Score counts of the same */
+  bool _analytics_stale = true;   /** Totals laid out after older keys */
+  ExamBatch _local_batch;         /** Exams scored here, reused */
+  std::vector<Job*> _jobs;        /** Running reviews, nested by preemption */
+  std::function<void(Priority)> _preemption;
+
+  std::vector<i32> _idle_workers() const;
+  std::vector<std::shared_ptr<Chunk>> _run(std::vector<MPIExam> exams,
+                                           bool ranked, i32 top_k,
+                                           Priority priority);
+  bool _score_here(const std::vector<MPIExam>& exams) const;
+  void _score_locally(Chunk& chunk);
+  void _dispatch_pending();
+  void _dispatch(const std::shared_ptr<Chunk>& chunk, i32 worker_rank);
+  bool _collect(bool blocking);
+  void _refresh_analytics();
+  void _redispatch_late(const std::vector<std::shared_ptr<Chunk>>& chunks);
+};
+
+#endif  // SCHEDULER_HPP
@@ -1,39 +1,198 @@
 #include <mpi.h>
+#include <charconv>
 #include <domain/coordinator.hpp>
 #include <domain/evaluator.hpp>
+#include <domain/exam_batch.hpp>
+#include <domain/node.hpp>
+#include <domain/ranking.hpp>
+#include <domain/result_store.hpp>
 #include <iostream>
+#include <server/bulk_scorer.hpp>
+#include <server/frontend.hpp>
 #include <server/server.hpp>
+#include <string_view>
 #include <system/aliases.hpp>
+#include <system/environment.hpp>
 #include <system/logger.hpp>
+#include <system/topology.hpp>
 
 i32 main(i32 argc, char** argv) {
-  MPI_Init(&argc, &argv);
+  // the server reads requests on a second thread, only main talks to MPI
+  i32 thread_support;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
   i32 rank, size;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Comm parent;
+  MPI_Comm_get_parent(&parent);
+  const bool spawned = parent != MPI_COMM_NULL;  // started by ADD_WORKERS
+  if (spawned) {
+    rank = MPICoordinator::instance().attach_to_parent(parent);
+  }
   Logger::config(rank);
+  if (thread_support < MPI_THREAD_FUNNELED) {
+    spdlog::critical("MPI provides thread level {}, the server needs "
+                     "MPI_THREAD_FUNNELED ({})",
+                     thread_support, MPI_THREAD_FUNNELED);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  i32 exit_code = 0;
+  const bool bulk = argc > 1 && std::string_view(argv[1]) == "score";
+  auto& node = NodeGroup::instance();
+  auto& frontends = FrontendGroup::instance();
+  if (!spawned) {
+    // ranks spawned later are left unpinned, they would land on the cores
+    // of the first ranks of their host
+    MPI_Comm host_comm;
+    i32 local_rank = 0;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &host_comm);
+    MPI_Comm_rank(host_comm, &local_rank);
+    MPI_Comm_free(&host_comm);
+    auto& topology = Topology::instance();
+    if (local_rank == 0) {
+      spdlog::info("Host topology: {}", topology.describe());
+    }
+    auto pin_mode = PinMode::NONE;
+    if (Environment::get("PIN_RANKS") == "core") {
+      pin_mode = PinMode::CORE;
+    } else if (Environment::get("PIN_RANKS") == "numa") {
+      pin_mode = PinMode::NUMA;
+    }
+    topology.place_rank(pin_mode, local_rank);
+    auto node_mode = NodeMode::OFF;
+    if (Environment::get("NODE_LOCAL") == "1") {
+      node_mode = NodeMode::SHARED;
+    } else if (Environment::get("NODE_TREE") == "1") {
+      node_mode = NodeMode::TREE;
+    }
+    // the first ranks accept clients, the master among them
+    i32 frontend_count = 1;
+    auto frontends_env = Environment::get("FRONTENDS");
+    if (frontends_env && !bulk) {
+      const auto& value = *frontends_env;
+      auto parsed = std::from_chars(value.data(), value.data() + value.size(),
+                                    frontend_count);
+      if (parsed.ec != std::errc() || frontend_count < 1 ||
+          frontend_count >= size) {
+        if (rank == 0) {
+          spdlog::error("FRONTENDS must be between 1 and {}, using 1",
+                        size - 1);
+        }
+        frontend_count = 1;
+      }
+    }
+    frontends.setup(frontend_count);
+    node.setup(node_mode, frontend_count);
+  }
   if (rank == 0) {
+    CoordinatorConfig coordinator_config;
+    coordinator_config.spawn_command = argv[0];
+    MPICoordinator::instance().set_config(coordinator_config);
+    MPICoordinator::instance().use_frontends(frontends.size());
+    if (node.enabled()) {
+      MPICoordinator::instance().use_node_leaders(node.node_sizes());
+    }
+    if (MPICoordinator::instance().workers().empty()) {
+      spdlog::info("No workers, every review is scored on the master");
+    }
+    if (auto store_path = Environment::get("RESULT_STORE")) {
+      try {
+        ResultStore::instance().open(*store_path);
+      } catch (std::exception& e) {
+        spdlog::error("Result store disabled: {}", e.what());
+      }
+    }
+    if (bulk) {
+      if (argc != 5) {
+        spdlog::error("Usage: {} score <keys.json> <exams> <results.ndjson>",
+                      argv[0]);
+        MPICoordinator::instance().send_shutdown_signal();
+        exit_code = 1;
+      } else {
+        BulkConfig bulk_config;
+        bulk_config.keys_path = argv[2];
+        bulk_config.exams_path = argv[3];
+        bulk_config.results_path = argv[4];
+        BulkScorer scorer(bulk_config);
+        exit_code = scorer.run() ? 0 : 1;
+      }
+    } else {
+      ServerConfig config;
+      config.capture_path = Environment::get("CAPTURE_FILE").value_or("");
+      config.reuse_port = frontends.enabled();
+      Server server(config);
+      server.start();
+    }
+    MPICoordinator::instance().free_types();
+  } else if (rank < frontends.size()) {
+    spdlog::info("Front-end {} started", rank);
     ServerConfig config;
+    if (auto capture_path = Environment::get("CAPTURE_FILE")) {
+      config.capture_path = *capture_path + "." + std::to_string(rank);
+    }
+    config.reuse_port = true;
     Server server(config);
     server.start();
     MPICoordinator::instance().free_types();
+  } else if (node.enabled() && !node.leader()) {
+    spdlog::info("Worker {} started, serving its node leader", rank);
+    while (node.serve()) {
+    }
+    MPICoordinator::instance().free_types();
+    spdlog::info("Worker {} received shutdown signal", rank);
   } else {
     spdlog::info("Worker {} started", rank);
     bool shutdown = false;
+    // reused across iterations, so the buffers only grow
+    ExamBatch exams;
+    // a shared node decodes the batch straight into its window
+    EncodedBatch encoded;
+    auto* undecoded = node.enabled() && node.decodes() ? &encoded : nullptr;
+    std::vector<MPIResult> results;
+    Analytics analytics;
+    std::vector<MPIResult> selected;
+    std::vector<ScoreCount> counts;
     while (!shutdown) {
       auto& coordinator = MPICoordinator::instance();
-      auto [exams, command] = coordinator.receive_from_master(0);
+      i32 top_k = 0;
+      auto command =
+          coordinator.receive_from_master(0, exams, top_k, undecoded);
       if (command == MPICommand::SHUTDOWN) {
         shutdown = true;
+        node.shutdown();
+        coordinator.detach_from_master();
         coordinator.free_types();
         spdlog::info("Worker {} received shutdown signal", rank);
         break;
       }
-      spdlog::info("Worker {} received exams count: {}", rank, exams.size());
-      auto results = Evaluator::instance().evaluate_exam_batch(exams);
-      coordinator.send_to_master(results, 0);
+      if (command != MPICommand::REVIEW && command != MPICommand::RANK) {
+        continue;  // answer keys only
+      }
+      spdlog::info("Worker {} received exams count: {}", rank,
+                   encoded.data != nullptr ? encoded.exams : exams.size());
+      std::span<const MPIResult> batch_results;
+      const Analytics* batch_analytics = &analytics;
+      if (node.enabled()) {
+        batch_results = node.review(exams, encoded);
+        batch_analytics = &node.analytics();
+      } else {
+        Evaluator::instance().evaluate_exam_batch(exams, results, analytics);
+        batch_results = results;
+      }
+      if (command == MPICommand::RANK) {
+        Ranking::count_scores(batch_results, counts);
+        if (top_k > 0) {
+          Ranking::select_top(batch_results, top_k, selected);
+          batch_results = selected;
+        }
+      }
+      coordinator.send_to_master(batch_results, *batch_analytics, 0);
+      if (command == MPICommand::RANK) {
+        coordinator.send_scores_to_master(counts, 0);
+      }
     }
   }
   MPI_Finalize();
-  return 0;
+  return exit_code;
 }
\ No newline at end of file
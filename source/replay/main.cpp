@@ -0,0 +1,71 @@
+#include <replay/replayer.hpp>
+#include <server/traffic_log.hpp>
+#include <string>
+#include <string_view>
+#include <system/aliases.hpp>
+#include <system/logger.hpp>
+
+namespace {
+
+void usage(const char* program) {
+  spdlog::error(
+      "Usage: {} play <capture> <results.ndjson> [--host H] [--port P] "
+      "[--speed X | --fast] [--concurrency N]",
+      program);
+  spdlog::error("       {} compare <baseline.ndjson> <candidate.ndjson>",
+                program);
+}
+
+}  // namespace
+
+/**
+ * @brief Replay a capture recorded with CAPTURE_FILE against a running
+ *        server, or compare the results of two replays
+ */
+i32 main(i32 argc, char** argv) {
+  Logger::config(0);
+  if (argc < 4) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::string_view mode = argv[1];
+  try {
+    if (mode == "compare" && argc == 4) {
+      auto baseline = Replayer::load(argv[2]);
+      auto candidate = Replayer::load(argv[3]);
+      return Replayer::compare(baseline, candidate) == 0 ? 0 : 1;
+    }
+    if (mode != "play") {
+      usage(argv[0]);
+      return 1;
+    }
+    ReplayConfig config;
+    for (i32 i = 4; i < argc; i++) {
+      std::string_view option = argv[i];
+      if (option == "--fast") {
+        config.speed = 0.0;
+      } else if (i + 1 < argc && option == "--host") {
+        config.host = argv[++i];
+      } else if (i + 1 < argc && option == "--port") {
+        config.port = static_cast<u16>(std::stoi(argv[++i]));
+      } else if (i + 1 < argc && option == "--speed") {
+        config.speed = std::stod(argv[++i]);
+      } else if (i + 1 < argc && option == "--concurrency") {
+        config.concurrency = static_cast<u32>(std::stoul(argv[++i]));
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    TrafficReader capture(argv[2]);
+    spdlog::info("Replaying {} requests from {} to {}:{}",
+                 capture.records().size(), argv[2], config.host, config.port);
+    auto results = Replayer(config).play(capture);
+    Replayer::save(results, argv[3]);
+    Replayer::summarize(results);
+  } catch (std::exception& e) {
+    spdlog::error("Replay error: {}", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,404 @@
+#include "replayer.hpp"
+#include <netdb.h>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <server/protocol.hpp>
+#include <stdexcept>
+#include <thread>
+
+using json = nlohmann::json;
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+
+constexpr u8 UNKNOWN_COMMAND = 0xff;
+
+constexpr std::array<std::string_view, MAX_COMMAND + 1> COMMAND_NAMES = {
+    "GET_ANSWERS",  "SET_ANSWERS", "REVIEW",         "ECHO",
+    "SHUTDOWN",     "ADD_WORKERS", "REMOVE_WORKERS", "ANALYTICS",
+    "RANK",         "STATUS",      "PATCH_ANSWERS",  "FETCH_RESULTS",
+    "PAGE_RESULTS", "TOP_RESULTS"};
+
+std::string_view command_name(u8 command) {
+  return command < COMMAND_NAMES.size() ? COMMAND_NAMES[command] : "INVALID";
+}
+
+/**
+ * @brief Command of a request, read from "SH <command>..."
+ */
+u8 command_of(std::string_view message) {
+  if (!message.starts_with("SH ")) {
+    return UNKNOWN_COMMAND;
+  }
+  u32 command = 0;
+  auto [end, error] = std::from_chars(message.data() + 3,
+                                      message.data() + message.size(), command);
+  if (error != std::errc() || command > MAX_COMMAND) {
+    return UNKNOWN_COMMAND;
+  }
+  return static_cast<u8>(command);
+}
+
+/**
+ * @brief Whether a request changes the keys or the workers
+ */
+bool changes_state(u8 command) {
+  switch (static_cast<ScoreHiveCommand>(command)) {
+    case ScoreHiveCommand::SET_ANSWERS:
+    case ScoreHiveCommand::PATCH_ANSWERS:
+    case ScoreHiveCommand::ADD_WORKERS:
+    case ScoreHiveCommand::REMOVE_WORKERS:
+    case ScoreHiveCommand::SHUTDOWN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+u64 fnv1a(std::string_view data) {
+  u64 hash = 14695981039346656037ull;
+  for (auto c : data) {
+    hash ^= static_cast<u8>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/**
+ * @brief Latency percentiles of the requests of one command, in ms
+ */
+struct Percentiles {
+  size_t count = 0;
+  f64 p50 = 0.0;
+  f64 p90 = 0.0;
+  f64 p99 = 0.0;
+  f64 max = 0.0;
+};
+
+std::map<u8, Percentiles> percentiles(
+    const std::vector<ReplayResult>& results) {
+  std::map<u8, std::vector<f64>> latencies;
+  for (const auto& result : results) {
+    latencies[result.command].push_back(result.latency_us / 1000.0);
+  }
+  std::map<u8, Percentiles> summary;
+  for (auto& [command, samples] : latencies) {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](f64 p) {
+      return samples[static_cast<size_t>(p * (samples.size() - 1))];
+    };
+    summary[command] = {samples.size(), at(0.50), at(0.90), at(0.99),
+                        samples.back()};
+  }
+  return summary;
+}
+
+}  // namespace
+
+Replayer::Replayer(const ReplayConfig& config) : _config(config) {
+  // admission waits for in_flight < concurrency, 0 would never admit
+  _config.concurrency = std::max(_config.concurrency, 1u);
+}
+
+std::vector<ReplayResult> Replayer::play(const TrafficReader& capture) const {
+  const auto& records = capture.records();
+  std::vector<ReplayResult> results(records.size());
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<size_t> pending;
+  size_t in_flight = 0;
+  bool done = false;
+  auto sender = [&]() {
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [&] { return done || !pending.empty(); });
+        if (pending.empty()) {
+          return;
+        }
+        index = pending.front();
+        pending.pop_front();
+      }
+      results[index] = _send(records[index].message);
+      {
+        std::lock_guard lock(mutex);
+        in_flight--;
+      }
+      changed.notify_all();
+    }
+  };
+  std::vector<std::jthread> senders;
+  for (u32 i = 0; i < _config.concurrency; i++) {
+    senders.emplace_back(sender);
+  }
+  auto start = steady_clock::now();
+  for (size_t i = 0; i < records.size(); i++) {
+    if (_config.speed > 0.0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<steady_clock::duration>(
+                      std::chrono::duration<f64, std::micro>(
+                          records[i].offset_us / _config.speed)));
+    }
+    auto alone = changes_state(command_of(records[i].message));
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] {
+      return alone ? in_flight == 0 : in_flight < _config.concurrency;
+    });
+    if (alone) {
+      lock.unlock();
+      results[i] = _send(records[i].message);
+      continue;
+    }
+    in_flight++;
+    pending.push_back(i);
+    lock.unlock();
+    changed.notify_all();
+  }
+  {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return in_flight == 0; });
+    done = true;
+  }
+  changed.notify_all();
+  return results;
+}
+
+ReplayResult Replayer::_send(std::string_view message) const {
+  ReplayResult result;
+  result.command = command_of(message);
+  auto started = steady_clock::now();
+  while (true) {
+    std::string response;
+    try {
+      response = _exchange(message);
+    } catch (std::exception& e) {
+      spdlog::warn("{} request failed: {}", command_name(result.command),
+                   e.what());
+      break;
+    }
+    // "SH <code> <length> <data>$\r\n"
+    i32 code = -1;
+    u64 length = 0;
+    std::string_view view(response);
+    auto* last = view.data() + view.size();
+    std::from_chars_result parsed{};
+    if (view.starts_with("SH ")) {
+      parsed = std::from_chars(view.data() + 3, last, code);
+    }
+    if (!view.starts_with("SH ") || parsed.ec != std::errc() ||
+        parsed.ptr == last ||
+        std::from_chars(parsed.ptr + 1, last, length).ec != std::errc()) {
+      spdlog::warn("Malformed response to {}", command_name(result.command));
+      break;
+    }
+    auto data_start = view.find(' ', parsed.ptr + 1 - view.data());
+    auto data = data_start == std::string_view::npos
+                    ? std::string_view()
+                    : view.substr(data_start + 1, length);
+    if (code == static_cast<i32>(ScoreHiveResponseCode::BUSY) &&
+        result.retries < _config.max_retries) {
+      result.retries++;
+      auto hint = json::parse(data, nullptr, false);
+      auto retry_after_ms =
+          hint.is_object() ? hint.value("retry_after_ms", 10u) : 10u;
+      std::this_thread::sleep_for(std::chrono::milliseconds(retry_after_ms));
+      continue;
+    }
+    result.code = code;
+    result.length = data.size();
+    result.digest = fnv1a(data);
+    break;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      steady_clock::now() - started);
+  result.latency_us = static_cast<u64>(elapsed.count());
+  return result;
+}
+
+std::string Replayer::_exchange(std::string_view message) const {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  auto port = std::to_string(_config.port);
+  auto error = getaddrinfo(_config.host.c_str(), port.c_str(), &hints,
+                           &addresses);
+  if (error != 0) {
+    throw std::runtime_error(gai_strerror(error));
+  }
+  i32 socket_fd = -1;
+  for (auto* address = addresses; address; address = address->ai_next) {
+    socket_fd = socket(address->ai_family, address->ai_socktype,
+                       address->ai_protocol);
+    if (socket_fd == -1) {
+      continue;
+    }
+    if (connect(socket_fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    close(socket_fd);
+    socket_fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (socket_fd == -1) {
+    throw std::runtime_error("Failed to connect: " +
+                             std::string(strerror(errno)));
+  }
+  size_t sent = 0;
+  while (sent < message.size()) {
+    auto result = send(socket_fd, message.data() + sent, message.size() - sent,
+                       MSG_NOSIGNAL);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      auto reason = std::string(strerror(errno));
+      close(socket_fd);
+      throw std::runtime_error("Failed to send: " + reason);
+    }
+    sent += static_cast<size_t>(result);
+  }
+  // the server closes the connection once the response is written
+  std::string response;
+  std::array<char, 64 * 1024> buffer;
+  while (true) {
+    auto result = recv(socket_fd, buffer.data(), buffer.size(), 0);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      auto reason = std::string(strerror(errno));
+      close(socket_fd);
+      throw std::runtime_error("Failed to receive: " + reason);
+    }
+    if (result == 0) {
+      break;
+    }
+    response.append(buffer.data(), static_cast<size_t>(result));
+  }
+  close(socket_fd);
+  return response;
+}
+
+void Replayer::save(const std::vector<ReplayResult>& results,
+                    const std::string& path) {
+  std::ofstream file(path, std::ios::trunc);
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    char digest[17];
+    std::snprintf(digest, sizeof(digest), "%016llx",
+                  static_cast<unsigned long long>(result.digest));
+    file << json{{"seq", i},
+                 {"command", result.command},
+                 {"code", result.code},
+                 {"latency_us", result.latency_us},
+                 {"retries", result.retries},
+                 {"length", result.length},
+                 {"digest", digest}}
+                .dump()
+         << '\n';
+  }
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Failed to write " + path);
+  }
+}
+
+std::vector<ReplayResult> Replayer::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  std::vector<ReplayResult> results;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    auto entry = json::parse(line);
+    ReplayResult result;
+    entry.at("command").get_to(result.command);
+    entry.at("code").get_to(result.code);
+    entry.at("latency_us").get_to(result.latency_us);
+    entry.at("retries").get_to(result.retries);
+    entry.at("length").get_to(result.length);
+    result.digest =
+        std::stoull(entry.at("digest").get<std::string>(), nullptr, 16);
+    results.push_back(result);
+  }
+  return results;
+}
+
+void Replayer::summarize(const std::vector<ReplayResult>& results) {
+  std::map<u8, size_t> errors;
+  std::map<u8, size_t> retries;
+  for (const auto& result : results) {
+    if (result.code != static_cast<i32>(ScoreHiveResponseCode::OK) &&
+        result.code != static_cast<i32>(ScoreHiveResponseCode::NOT_MODIFIED)) {
+      errors[result.command]++;
+    }
+    retries[result.command] += result.retries;
+  }
+  spdlog::info("{:<15} {:>7} {:>7} {:>7} {:>10} {:>10} {:>10} {:>10}",
+               "command", "count", "errors", "retries", "p50 ms", "p90 ms",
+               "p99 ms", "max ms");
+  for (const auto& [command, p] : percentiles(results)) {
+    spdlog::info(
+        "{:<15} {:>7} {:>7} {:>7} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f}",
+        command_name(command), p.count, errors[command], retries[command],
+        p.p50, p.p90, p.p99, p.max);
+  }
+}
+
+size_t Replayer::compare(const std::vector<ReplayResult>& baseline,
+                         const std::vector<ReplayResult>& candidate) {
+  if (baseline.size() != candidate.size()) {
+    throw std::runtime_error("The replays have a different number of requests");
+  }
+  constexpr size_t MAX_REPORTED = 20;
+  size_t mismatches = 0;
+  for (size_t i = 0; i < baseline.size(); i++) {
+    const auto& expected = baseline[i];
+    const auto& actual = candidate[i];
+    if (expected.command != actual.command) {
+      throw std::runtime_error("The replays come from different captures");
+    }
+    if (expected.command == static_cast<u8>(ScoreHiveCommand::STATUS) ||
+        (expected.code == actual.code && expected.digest == actual.digest)) {
+      continue;
+    }
+    if (++mismatches <= MAX_REPORTED) {
+      spdlog::warn("Request {} ({}) differs: code {} -> {}, {} -> {} bytes", i,
+                   command_name(expected.command), expected.code, actual.code,
+                   expected.length, actual.length);
+    }
+  }
+  auto before = percentiles(baseline);
+  auto after = percentiles(candidate);
+  spdlog::info("{:<15} {:>7} {:>21} {:>21} {:>8}", "command", "count",
+               "p50 ms (base -> new)", "p99 ms (base -> new)", "p99 x");
+  for (const auto& [command, base] : before) {
+    const auto& next = after[command];
+    auto ratio = base.p99 > 0.0 ? next.p99 / base.p99 : 0.0;
+    spdlog::info(
+        "{:<15} {:>7} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f} {:>8.2f}",
+        command_name(command), base.count, base.p50, next.p50, base.p99,
+        next.p99, ratio);
+  }
+  spdlog::info("{} of {} responses differ", mismatches, baseline.size());
+  return mismatches;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#ifndef REPLAYER_HPP
+#define REPLAYER_HPP
+
+#include <server/traffic_log.hpp>
+#include <string>
+#include <string_view>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Replay configuration
+ */
+struct ReplayConfig {
+  std::string host = "127.0.0.1"; /** Server to replay against */
+  u16 port = 8080;
+  f64 speed = 1.0;       /** Multiple of the captured pace, 0 for no pauses */
+  u32 concurrency = 64;  /** Requests in flight at once, at least 1 */
+  u32 max_retries = 100; /** Retries of a request refused as BUSY */
+};
+
+/**
+ * @brief Outcome of one replayed request
+ * @details The payload itself is not kept, only its size and digest.
+ */
+struct ReplayResult {
+  u8 command = 0;      /** Command of the request, as captured */
+  i32 code = -1;       /** Response code, -1 if no response came */
+  u64 latency_us = 0;  /** From the first send to the response, retries in */
+  u32 retries = 0;     /** Times the request was refused as BUSY */
+  u64 length = 0;      /** Payload size */
+  u64 digest = 0;      /** FNV-1a of the payload */
+};
+
+/**
+ * @brief Plays a traffic capture back against a running server
+ * @details Requests are sent in capture order, each on its own connection
+ *          like the original clients, at the captured pace scaled by
+ *          ReplayConfig::speed. Requests that change the keys or the workers
+ *          (SET_ANSWERS, PATCH_ANSWERS, ADD_WORKERS, REMOVE_WORKERS and
+ *          SHUTDOWN) wait for the requests in flight and run alone, so every
+ *          other request sees the same state in every replay and two builds
+ *          can be compared payload by payload. A BUSY response is retried
+ *          after its retry_after_ms hint.
+ */
+class Replayer {
+ public:
+  explicit Replayer(const ReplayConfig& config);
+
+  /**
+   * @brief Replay every request of a capture
+   * @return Outcome of each request, in capture order
+   */
+  std::vector<ReplayResult> play(const TrafficReader& capture) const;
+
+  /**
+   * @brief Write the results as NDJSON, one request per line
+   * @throws std::runtime_error if the file cannot be written
+   */
+  static void save(const std::vector<ReplayResult>& results,
+                   const std::string& path);
+
+  /**
+   * @brief Read results written by save()
+   * @throws std::runtime_error if the file cannot be read
+   */
+  static std::vector<ReplayResult> load(const std::string& path);
+
+  /**
+   * @brief Log the count, errors and latency percentiles of each command
+   */
+  static void summarize(const std::vector<ReplayResult>& results);
+
+  /**
+   * @brief Compare two replays of the same capture
+   * @details Logs the requests whose response differs (STATUS responses
+   *          report live queue state and are never compared) and the latency
+   *          percentiles of each command side by side.
+   * @return Number of requests whose response differs
+   * @throws std::runtime_error if they do not replay the same capture
+   */
+  static size_t compare(const std::vector<ReplayResult>& baseline,
+                        const std::vector<ReplayResult>& candidate);
+
+ private:
+  ReplayConfig _config;
+
+  /**
+   * @brief Send a request until it is not refused as BUSY
+   */
+  ReplayResult _send(std::string_view message) const;
+
+  /**
+   * @brief Send a request on a new connection and read the whole response
+   * @throws std::runtime_error if the connection fails
+   */
+  std::string _exchange(std::string_view message) const;
+};
+
+#endif  // REPLAYER_HPP
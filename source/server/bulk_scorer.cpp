@@ -0,0 +1,113 @@
+#include "bulk_scorer.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <domain/answers.hpp>
+#include <domain/scheduler.hpp>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <system/mapped_file.hpp>
+
+using json = nlohmann::json;
+
+BulkScorer::BulkScorer(const BulkConfig& config) : _config(config) {}
+
+bool BulkScorer::run() {
+  bool ok = true;
+  try {
+    MappedFile keys(_config.keys_path);
+    auto keys_data = keys.data();
+    AnswersManager::instance().load_from_json(
+        json::parse(keys_data.begin(), keys_data.end()));
+    MappedFile exams(_config.exams_path);
+    _results.open(_config.results_path, std::ios::binary | std::ios::trunc);
+    if (!_results) {
+      throw std::runtime_error("Failed to open " + _config.results_path);
+    }
+    auto data = exams.data();
+    spdlog::info("Scoring {} ({} bytes)", _config.exams_path, data.size());
+    if (data.size() >= sizeof(PACKED_MAGIC) &&
+        std::memcmp(data.data(), PACKED_MAGIC, sizeof(PACKED_MAGIC)) == 0) {
+      _score_packed(data.subspan(sizeof(PACKED_MAGIC)));
+    } else {
+      _score_ndjson(data);
+    }
+    _flush();
+    _results.close();
+    if (!_results) {
+      throw std::runtime_error("Failed to write " + _config.results_path);
+    }
+    spdlog::info("Scored {} exams into {}", _scored, _config.results_path);
+  } catch (std::exception& e) {
+    spdlog::error("Bulk scoring error: {}", e.what());
+    ok = false;
+  }
+  Scheduler::instance().drain();
+  MPICoordinator::instance().send_shutdown_signal();
+  return ok;
+}
+
+void BulkScorer::_score_ndjson(std::span<const u8> data) {
+  auto& coordinator = MPICoordinator::instance();
+  json lines = json::array();
+  auto it = data.begin();
+  while (it != data.end()) {
+    auto line_end = std::find(it, data.end(), '\n');
+    if (std::any_of(it, line_end, [](u8 c) { return !std::isspace(c); })) {
+      lines.push_back(json::parse(it, line_end));
+    }
+    it = line_end == data.end() ? line_end : line_end + 1;
+    if (lines.size() == _config.batch_exams) {
+      auto exams = coordinator.parse_exams(lines);
+      std::move(exams.begin(), exams.end(), std::back_inserter(_batch));
+      lines = json::array();
+      _flush();
+    }
+  }
+  auto exams = coordinator.parse_exams(lines);
+  std::move(exams.begin(), exams.end(), std::back_inserter(_batch));
+}
+
+void BulkScorer::_score_packed(std::span<const u8> data) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    MPIExamHeader header;
+    if (data.size() - offset < sizeof(header)) {
+      throw std::runtime_error("Malformed packed exams file");
+    }
+    std::memcpy(&header, data.data() + offset, sizeof(header));
+    offset += sizeof(header);
+    if (header.answers_size < 0 ||
+        static_cast<size_t>(header.answers_size) >
+            (data.size() - offset) / sizeof(MPIQuestion)) {
+      throw std::runtime_error("Malformed packed exams file");
+    }
+    auto& exam = _batch.emplace_back();
+    exam.stage = header.stage;
+    exam.id_exam = header.id_exam;
+    exam.answers.resize(header.answers_size);
+    std::memcpy(exam.answers.data(), data.data() + offset,
+                exam.answers.size() * sizeof(MPIQuestion));
+    offset += exam.answers.size() * sizeof(MPIQuestion);
+    if (_batch.size() == _config.batch_exams) {
+      _flush();
+    }
+  }
+}
+
+void BulkScorer::_flush() {
+  if (_batch.empty()) {
+    return;
+  }
+  auto results = Scheduler::instance().review(std::move(_batch));
+  _batch.clear();
+  std::string lines;
+  for (const auto& result : results) {
+    lines += json(result).dump();
+    lines += '\n';
+  }
+  _results.write(lines.data(), static_cast<std::streamsize>(lines.size()));
+  _scored += results.size();
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef BULK_SCORER_HPP
+#define BULK_SCORER_HPP
+
+#include <domain/coordinator.hpp>
+#include <fstream>
+#include <span>
+#include <string>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Bulk scorer configuration
+ */
+struct BulkConfig {
+  std::string keys_path;     /** Answer keys, same JSON as SET_ANSWERS */
+  std::string exams_path;    /** Exams, NDJSON or packed */
+  std::string results_path;  /** Results, NDJSON */
+  size_t batch_exams = 4096; /** Exams handed to the scheduler at a time */
+};
+
+/**
+ * @brief Offline scoring of an exam file, without the TCP server
+ * @details Started with `ScoreHiveCluster score <keys> <exams> <results>`.
+ *          The exams file is memory-mapped and streamed to the workers in
+ *          batches through the Scheduler, like REVIEW requests. Results are
+ *          written as NDJSON, one MPIResult per line, in input order.
+ *          Two exam formats are accepted:
+ *          - NDJSON: one exam object per line, as in a REVIEW request
+ *          - packed: PACKED_MAGIC then, for each exam, an MPIExamHeader
+ *            followed by its answers_size MPIQuestion records, in native
+ *            byte order
+ */
+class BulkScorer {
+ public:
+  static constexpr char PACKED_MAGIC[4] = {'S', 'H', 'B', '1'};
+
+  explicit BulkScorer(const BulkConfig& config);
+
+  /**
+   * @brief Score the whole file, then shut the workers down
+   * @return False if the scoring failed, the error is logged
+   */
+  bool run();
+
+ private:
+  BulkConfig _config;
+  std::ofstream _results;
+  std::vector<MPIExam> _batch;
+  size_t _scored = 0;
+
+  void _score_ndjson(std::span<const u8> data);
+  void _score_packed(std::span<const u8> data);
+  void _flush();
+};
+
+#endif  // BULK_SCORER_HPP
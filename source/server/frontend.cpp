@@ -0,0 +1,277 @@
+#include "frontend.hpp"
+#include <spdlog/spdlog.h>
+#include <cstring>
+#include <domain/exam_batch.hpp>
+#include <domain/exam_codec.hpp>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+std::unique_ptr<FrontendGroup> FrontendGroup::_instance = nullptr;
+
+FrontendGroup& FrontendGroup::instance() {
+  static std::once_flag flag;
+  std::call_once(flag, []() { _instance.reset(new FrontendGroup()); });
+  return *_instance;
+}
+
+void FrontendGroup::setup(i32 frontends) {
+  if (frontends <= 1) {
+    return;
+  }
+  i32 rank = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_split(MPI_COMM_WORLD, rank < frontends ? 0 : MPI_UNDEFINED, rank,
+                 &_comm);
+  if (_comm == MPI_COMM_NULL) {
+    return;  // worker
+  }
+  MPI_Comm_rank(_comm, &_rank);
+  MPI_Comm_size(_comm, &_size);
+  if (primary()) {
+    spdlog::info("{} front-ends accepting clients", _size);
+  }
+}
+
+u64 FrontendGroup::forward(const ScoreHiveRequest& request,
+                           Priority priority, u64 exams) {
+  FrontendHeader header{static_cast<u8>(Kind::REQUEST),
+                        static_cast<u8>(request.command),
+                        static_cast<u8>(priority), 0, 0, exams, 0};
+  auto message = _message();
+  message += request.data;
+  return _relay(header, std::move(message));
+}
+
+u64 FrontendGroup::review(ScoreHiveCommand command,
+                          const std::vector<MPIExam>& exams,
+                          Priority priority, i32 top_k) {
+  FrontendHeader header{static_cast<u8>(Kind::REVIEW),
+                        static_cast<u8>(command),
+                        static_cast<u8>(priority), top_k, 0, exams.size(), 0};
+  auto message = _message();
+  ExamCodec::encode(exams, message);
+  return _relay(header, std::move(message));
+}
+
+u64 FrontendGroup::query(ScoreHiveCommand command, const std::string& data) {
+  FrontendHeader header{static_cast<u8>(Kind::QUERY),
+                        static_cast<u8>(command),
+                        static_cast<u8>(Priority::NORMAL), 0, 0, 0, 0};
+  auto message = _message();
+  message += data;
+  return _relay(header, std::move(message));
+}
+
+bool FrontendGroup::collect(u64& relay, ScoreHiveResponse& response) {
+  _reap();
+  i32 flag = 0;
+  auto probe_result =
+      MPI_Iprobe(0, TAG_REPLY, _comm, &flag, MPI_STATUS_IGNORE);
+  if (probe_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to probe the primary");
+  }
+  if (!flag) {
+    return false;
+  }
+  FrontendHeader header;
+  response.data = _receive(header, 0, TAG_REPLY);
+  response.code = static_cast<ScoreHiveResponseCode>(header.command);
+  response.length = response.data.size();
+  relay = header.relay;
+  return true;
+}
+
+bool FrontendGroup::receive(PendingRequest& pending) {
+  _reap();
+  i32 flag = 0;
+  MPI_Status status;
+  auto probe_result =
+      MPI_Iprobe(MPI_ANY_SOURCE, TAG_REQUEST, _comm, &flag, &status);
+  if (probe_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to probe front-ends");
+  }
+  if (!flag) {
+    return false;
+  }
+  FrontendHeader header;
+  auto data = _receive(header, status.MPI_SOURCE, TAG_REQUEST);
+  auto kind = static_cast<Kind>(header.kind);
+  auto command = static_cast<ScoreHiveCommand>(header.command);
+  const bool exams = command == ScoreHiveCommand::REVIEW ||
+                     command == ScoreHiveCommand::RANK;
+  const bool query = command == ScoreHiveCommand::FETCH_RESULTS ||
+                     command == ScoreHiveCommand::PAGE_RESULTS ||
+                     command == ScoreHiveCommand::TOP_RESULTS;
+  if (header.command > MAX_COMMAND || header.priority >= PRIORITY_CLASSES ||
+      (kind == Kind::REVIEW && !exams) || (kind == Kind::QUERY && !query)) {
+    throw std::runtime_error("Invalid request relayed by a front-end");
+  }
+  pending.client_fd = -1;
+  pending.frontend = status.MPI_SOURCE;
+  pending.relay = header.relay;
+  pending.top_k = header.top_k;
+  pending.encoded = kind == Kind::REVIEW || kind == Kind::QUERY;
+  pending.request.command = command;
+  pending.request.length = data.size();
+  pending.request.data = std::move(data);
+  pending.exams = header.exams;
+  pending.bytes = pending.request.length;
+  pending.priority = static_cast<Priority>(header.priority);
+  return true;
+}
+
+std::vector<MPIExam> FrontendGroup::decode(const ScoreHiveRequest& request,
+                                           u64 exams) {
+  ExamBatch batch;
+  ExamCodec::decode(request.data, static_cast<i32>(exams), batch);
+  std::vector<MPIExam> decoded(batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto exam = batch[i];
+    decoded[i].stage = exam.stage;
+    decoded[i].id_exam = exam.id_exam;
+    decoded[i].answers.assign(exam.answers.begin(), exam.answers.end());
+  }
+  return decoded;
+}
+
+void FrontendGroup::reply(i32 frontend, u64 relay,
+                          const ScoreHiveResponse& response) {
+  FrontendHeader header{static_cast<u8>(Kind::REPLY),
+                        static_cast<u8>(response.code), 0, 0, relay, 0, 0};
+  auto message = _message();
+  message += response.data;
+  _send(header, std::move(message), frontend, TAG_REPLY);
+}
+
+void FrontendGroup::stop() {
+  if (!enabled()) {
+    return;
+  }
+  if (!primary()) {
+    // STOPPED and the last relays may still be on their way
+    for (auto& send : _sends) {
+      MPI_Wait(&send.request, MPI_STATUS_IGNORE);
+    }
+    _sends.clear();
+    return;
+  }
+  FrontendHeader stop{static_cast<u8>(Kind::STOP), 0, 0, 0, 0, 0, 0};
+  for (i32 frontend = 1; frontend < _size; frontend++) {
+    _send(stop, _message(), frontend, TAG_STOP);
+  }
+  // a front-end may have relayed requests before it saw the stop, it is
+  // still waiting for their answers
+  ScoreHiveResponse refused;
+  refused.code = ScoreHiveResponseCode::ERROR;
+  refused.data = "Server is shutting down";
+  refused.length = refused.data.size();
+  auto running = _size - 1;
+  while (running > 0) {
+    MPI_Status status;
+    auto probe_result = MPI_Probe(MPI_ANY_SOURCE, TAG_REQUEST, _comm, &status);
+    if (probe_result != MPI_SUCCESS) {
+      throw std::runtime_error("Failed to probe front-ends");
+    }
+    FrontendHeader header;
+    _receive(header, status.MPI_SOURCE, TAG_REQUEST);
+    if (static_cast<Kind>(header.kind) == Kind::STOPPED) {
+      running--;
+      continue;
+    }
+    reply(status.MPI_SOURCE, header.relay, refused);
+  }
+  for (auto& send : _sends) {
+    MPI_Wait(&send.request, MPI_STATUS_IGNORE);
+  }
+  _sends.clear();
+  spdlog::info("Front-ends stopped");
+}
+
+bool FrontendGroup::stopping() {
+  if (_stopped) {
+    return true;
+  }
+  i32 flag = 0;
+  auto probe_result =
+      MPI_Iprobe(0, TAG_STOP, _comm, &flag, MPI_STATUS_IGNORE);
+  if (probe_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to probe the primary");
+  }
+  if (!flag) {
+    return false;
+  }
+  FrontendHeader header;
+  _receive(header, 0, TAG_STOP);
+  // on the request tag, so it arrives after anything relayed before
+  FrontendHeader stopped{static_cast<u8>(Kind::STOPPED), 0, 0, 0, 0, 0, 0};
+  _send(stopped, _message(), 0, TAG_REQUEST);
+  _stopped = true;
+  return true;
+}
+
+u64 FrontendGroup::_relay(FrontendHeader header, std::string message) {
+  header.relay = _next_relay++;
+  _send(header, std::move(message), 0, TAG_REQUEST);
+  return header.relay;
+}
+
+void FrontendGroup::_send(FrontendHeader header, std::string message,
+                          i32 rank, i32 tag) {
+  if (message.size() > static_cast<size_t>(std::numeric_limits<i32>::max())) {
+    throw std::runtime_error("Failed to send to front-end " +
+                             std::to_string(rank) + ": " +
+                             std::to_string(message.size()) +
+                             " bytes do not fit in one message");
+  }
+  header.bytes = message.size() - sizeof(header);
+  std::memcpy(message.data(), &header, sizeof(header));
+  auto& send = _sends.emplace_back(Send{MPI_REQUEST_NULL, std::move(message)});
+  auto send_result =
+      MPI_Isend(send.message.data(), static_cast<i32>(send.message.size()),
+                MPI_BYTE, rank, tag, _comm, &send.request);
+  if (send_result != MPI_SUCCESS) {
+    _sends.pop_back();
+    throw std::runtime_error("Failed to send to front-end " +
+                             std::to_string(rank));
+  }
+}
+
+std::string FrontendGroup::_receive(FrontendHeader& header, i32 rank,
+                                    i32 tag) {
+  MPI_Status status;
+  i32 size = 0;
+  auto recv_result = MPI_Probe(rank, tag, _comm, &status);
+  if (recv_result == MPI_SUCCESS) {
+    recv_result = MPI_Get_count(&status, MPI_BYTE, &size);
+  }
+  auto bytes = recv_result == MPI_SUCCESS ? static_cast<size_t>(size) : 0;
+  std::string message(bytes, '\0');
+  if (recv_result == MPI_SUCCESS) {
+    recv_result = MPI_Recv(message.data(), size, MPI_BYTE, rank, tag, _comm,
+                           MPI_STATUS_IGNORE);
+  }
+  if (recv_result != MPI_SUCCESS) {
+    throw std::runtime_error("Failed to receive from front-end " +
+                             std::to_string(rank));
+  }
+  if (message.size() < sizeof(header)) {
+    throw std::runtime_error("Malformed message from front-end " +
+                             std::to_string(rank));
+  }
+  std::memcpy(&header, message.data(), sizeof(header));
+  if (header.bytes != message.size() - sizeof(header)) {
+    throw std::runtime_error("Malformed message from front-end " +
+                             std::to_string(rank));
+  }
+  message.erase(0, sizeof(header));
+  return message;
+}
+
+void FrontendGroup::_reap() {
+  std::erase_if(_sends, [](Send& send) {
+    i32 done = 0;
+    MPI_Test(&send.request, &done, MPI_STATUS_IGNORE);
+    return done != 0;
+  });
+}
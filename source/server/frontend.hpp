@@ -0,0 +1,199 @@
+#pragma once
+#ifndef FRONTEND_HPP
+#define FRONTEND_HPP
+
+#include <mpi.h>
+#include <domain/coordinator.hpp>
+#include <domain/scheduler.hpp>
+#include <list>
+#include <memory>
+#include <server/protocol.hpp>
+#include <server/request_queue.hpp>
+#include <string>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Header of a message between a front-end and the primary
+ */
+struct FrontendHeader {
+  u8 kind;     /** FrontendGroup::Kind */
+  u8 command;  /** ScoreHiveCommand, or ScoreHiveResponseCode of a reply */
+  u8 priority; /** Priority of a request */
+  i32 top_k;   /** Best exams kept per stage of a RANK request */
+  u64 relay;   /** Id of the request, its reply carries it back */
+  u64 exams;   /** Exams of a request */
+  u64 bytes;   /** Payload that follows, in the same message */
+};
+
+/**
+ * @brief Ranks accepting clients
+ * @details The first `frontends` ranks of MPI_COMM_WORLD all run a Server on
+ *          the same port (SO_REUSEPORT on a shared host), and are grouped in
+ *          their own communicator. Rank 0, the primary, is the only one that
+ *          runs the Scheduler and holds the answer keys and the ResultStore:
+ *          - REVIEW and RANK requests are parsed on the front-end that read
+ *            them, sent to the primary in ExamCodec form and their results
+ *            come back as MPIResult records, so the front-end also writes
+ *            the JSON. FETCH_RESULTS, PAGE_RESULTS and TOP_RESULTS go the
+ *            same way as binary queries.
+ *          - Every other request is relayed as is and answered by the
+ *            primary, so all the front-ends see one version of the keys.
+ *          Relayed requests go through the request queue of the primary like
+ *          those of its own clients, so their replies may come back in any
+ *          order. A front-end does not wait for them: every message is sent
+ *          with MPI_Isend and the replies are probed for from the server
+ *          loop, matched to their request by its relay id.
+ */
+class FrontendGroup {
+ public:
+  static FrontendGroup& instance();
+  ~FrontendGroup() = default;
+
+  /**
+   * @brief Group the front-end ranks
+   * @param frontends Ranks accepting clients, rank 0 included
+   * @details Collective over MPI_COMM_WORLD, every rank started by mpirun
+   *          must call it with the same `frontends`.
+   */
+  void setup(i32 frontends);
+
+  bool enabled() const { return _size > 1; }
+
+  bool primary() const { return _rank == 0; }
+
+  i32 size() const { return _size; }
+
+  /**
+   * @brief Relay a request to the primary as is, without waiting
+   * @return Relay id of the request, see collect()
+   * @throws std::runtime_error if the primary cannot be reached
+   */
+  u64 forward(const ScoreHiveRequest& request, Priority priority, u64 exams);
+
+  /**
+   * @brief Have parsed exams reviewed or ranked on the primary
+   * @param command REVIEW or RANK
+   * @return Relay id of the request, see collect()
+   * @throws std::runtime_error if the primary cannot be reached
+   */
+  u64 review(ScoreHiveCommand command, const std::vector<MPIExam>& exams,
+             Priority priority, i32 top_k);
+
+  /**
+   * @brief Relay a result store query in binary form
+   * @param command FETCH_RESULTS, PAGE_RESULTS or TOP_RESULTS
+   * @return Relay id of the request, see collect()
+   * @throws std::runtime_error if the primary cannot be reached
+   */
+  u64 query(ScoreHiveCommand command, const std::string& data);
+
+  /**
+   * @brief Take the next reply of the primary (front-end only)
+   * @details Never waits.
+   * @param relay Relay id of the request it answers
+   * @return False if none has arrived
+   */
+  bool collect(u64& relay, ScoreHiveResponse& response);
+
+  /**
+   * @brief Take the next request relayed by a front-end (primary only)
+   * @details A request relayed in binary form keeps it in the request data,
+   *          with PendingRequest::encoded set. Never waits.
+   * @return False if none is waiting
+   */
+  bool receive(PendingRequest& pending);
+
+  /**
+   * @brief Exams of a relayed REVIEW or RANK
+   * @throws std::runtime_error if they do not decode
+   */
+  static std::vector<MPIExam> decode(const ScoreHiveRequest& request,
+                                     u64 exams);
+
+  /**
+   * @brief Answer a relayed request (primary only), without waiting
+   * @param relay PendingRequest::relay of the request
+   */
+  void reply(i32 frontend, u64 relay, const ScoreHiveResponse& response);
+
+  /**
+   * @brief Stop the front-ends once the primary is done (primary), or wait
+   *        for the last messages of a front-end to go out
+   * @details Requests relayed until every front-end has stopped are refused.
+   */
+  void stop();
+
+  /**
+   * @brief Whether the primary asked this front-end to stop
+   * @details The first time it returns true the front-end acknowledges, it
+   *          must not relay anything afterwards. The replies of what it
+   *          relayed before still come.
+   */
+  bool stopping();
+
+ private:
+  enum class Kind : u8 {
+    REQUEST = 0, /** Request relayed as is */
+    REVIEW = 1,  /** REVIEW or RANK, exams in ExamCodec form */
+    REPLY = 2,   /** Response of the primary */
+    STOP = 3,    /** The primary is shutting down */
+    STOPPED = 4, /** The front-end relays nothing more */
+    QUERY = 5,   /** Result store query in binary form */
+  };
+
+  static constexpr i32 TAG_REQUEST = 1; /** Front-end to primary */
+  static constexpr i32 TAG_REPLY = 2;   /** Primary to front-end */
+  static constexpr i32 TAG_STOP = 3;    /** Primary to front-end, once */
+
+  /**
+   * @brief Message on its way, its buffer lives until MPI is done with it
+   */
+  struct Send {
+    MPI_Request request;
+    std::string message; /** Header, then payload */
+  };
+
+  FrontendGroup() = default;
+  static std::unique_ptr<FrontendGroup> _instance;
+  MPI_Comm _comm = MPI_COMM_NULL;
+  i32 _rank = 0;
+  i32 _size = 1;
+  bool _stopped = false;
+  u64 _next_relay = 0;
+  std::list<Send> _sends;
+
+  /**
+   * @brief Empty message with room for its header
+   */
+  static std::string _message() {
+    return std::string(sizeof(FrontendHeader), '\0');
+  }
+
+  /**
+   * @brief Relay a request built with _message() to the primary
+   * @return Its relay id
+   */
+  u64 _relay(FrontendHeader header, std::string message);
+
+  /**
+   * @brief Send a message built with _message(), without waiting
+   * @details Writes the header into its room, sets header.bytes.
+   * @throws std::runtime_error if it is too large for MPI or fails
+   */
+  void _send(FrontendHeader header, std::string message, i32 rank, i32 tag);
+
+  /**
+   * @brief Receive a message that has arrived or is arriving
+   * @return Its payload
+   * @throws std::runtime_error if it fails or is malformed
+   */
+  std::string _receive(FrontendHeader& header, i32 rank, i32 tag);
+
+  /**
+   * @brief Drop the messages MPI is done with
+   */
+  void _reap();
+};
+
+#endif  // FRONTEND_HPP
@@ -14,26 +14,65 @@ enum class ScoreHiveCommand : u8 {
   GET_ANSWERS = 0, /** Get answers from the server */
   SET_ANSWERS = 1, /** Set answers to the server */
   REVIEW = 2,      /** Review answers from the server */
-  ECHO = 3,        /** Echo the data to the server */
-  SHUTDOWN = 4     /** Shutdown the server */
+  ECHO = 3,          /** Echo the data to the server */
+  SHUTDOWN = 4,      /** Shutdown the server */
+  ADD_WORKERS = 5,   /** Spawn workers at runtime */
+  REMOVE_WORKERS = 6, /** Drain and retire workers at runtime */
+  ANALYTICS = 7,      /** Per-stage and per-question review totals */
+  RANK = 8,           /** Review and rank the exams within their stage */
+  STATUS = 9,         /** Depth and limits of the request queue */
+  PATCH_ANSWERS = 10, /** Change some questions of the answer keys */
+  FETCH_RESULTS = 11, /** Stored results of some exams */
+  PAGE_RESULTS = 12,  /** Stored results of a stage, page by page */
+  TOP_RESULTS = 13,   /** Best stored results of a stage */
 };
 
 enum class ScoreHiveResponseCode : u8 {
-  OK = 0,    /** OK */
-  ERROR = 1, /** Error */
+  OK = 0,           /** OK */
+  ERROR = 1,        /** Error */
+  BUSY = 2,         /** Request queue full, retry after the hinted delay */
+  NOT_MODIFIED = 3, /** Conditional GET_ANSWERS, nothing changed */
 };
 
-static constexpr u8 MAX_COMMAND = 4; /** Maximum number of commands */
+static constexpr u8 MAX_COMMAND = 13; /** Maximum number of commands */
 
 /**
  * @brief ScoreHive message. The message is used to communicate with the
  *        ScoreHive server.
  * @details The signatures of the commands are:
- *          - GET_ANSWERS: "SH 0$"
+ *          - GET_ANSWERS: "SH 0$" for every stage, or
+ *            "SH 0 <length> <query>$" with the query
+ *            {"stages": [...], "if_newer_than": V} or
+ *            {"stages": [...], "if_none_match": "<etag>"}, every key optional.
+ *            A query is answered with {"etag", "stages": [...], "version"},
+ *            only the stages changed after V when if_newer_than is set, or
+ *            with NOT_MODIFIED {"version"} when none of them changed.
  *          - SET_ANSWERS: "SH 1 <length> <data>$"
- *          - REVIEW: "SH 2 <length> <data>$"
+ *          - REVIEW: "SH 2 <length> <data>$", data is the exams array or
+ *            {"exams": [...], "priority": "high" | "normal" | "low"}
  *          - ECHO: "SH 3 <length> <data>$" 
  *          - SHUTDOWN: "SH 4$"
+ *          - ADD_WORKERS: "SH 5 <length> <count>$"
+ *          - REMOVE_WORKERS: "SH 6 <length> <count>$"
+ *          - ANALYTICS: "SH 7$"
+ *          - RANK: "SH 8 <length> <data>$", data is the exams array or
+ *            {"exams": [...], "top_k": K, "priority": ...}
+ *          - STATUS: "SH 9$"
+ *          - PATCH_ANSWERS: "SH 10 <length> <data>$", data is an array of
+ *            {"stage": S, "answers": [...], "scoring": {...}} where each
+ *            answer replaces the key of its question, {"qst_idx": Q,
+ *            "remove": true} drops it (see AnswersManager::patch_from_json)
+ *          - FETCH_RESULTS: "SH 11 <length> <data>$", data is an array of
+ *            {"stage", "id_exam"}, answered with their latest results in the
+ *            same order, null for the exams never reviewed
+ *          - PAGE_RESULTS: "SH 12 <length> <data>$", data is
+ *            {"stage": S, "after": id_exam, "limit": N}, "after" omitted for
+ *            the first page; answered with {"results": [...], "next"}, next
+ *            being the "after" of the following page or null after the last
+ *          - TOP_RESULTS: "SH 13 <length> <data>$", data is
+ *            {"stage": S, "top_k": K}, answered like RANK with top_k
+ *          The results commands are served from the ResultStore, which is
+ *          only open when RESULT_STORE names its file.
  */
 struct ScoreHiveRequest {
   const char* magic = "SH"; /** Magic string of the message */
@@ -45,6 +84,9 @@ struct ScoreHiveRequest {
 /**
  * @brief ScoreHive response. The response is used to communicate with the
  *        ScoreHive server.
+ * @details BUSY responses carry {"retry_after_ms", "queued", "exams", "bytes"}
+ *          and STATUS responses the same depth plus the queue limits and the
+ *          latency of each priority class.
  */
 struct ScoreHiveResponse {
   const char* magic = "SH";   /** Magic string of the message */
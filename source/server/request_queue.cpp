@@ -0,0 +1,182 @@
+#include "request_queue.hpp"
+#include <algorithm>
+#include <cmath>
+
+RequestQueue::RequestQueue(const QueueLimits& limits) : _limits(limits) {}
+
+Admission RequestQueue::push(PendingRequest request) {
+  {
+    std::lock_guard lock(_mutex);
+    if (_closed) {
+      return Admission::CLOSED;
+    }
+    if (_depth.requests > 0 &&
+        (_depth.requests >= _limits.max_requests ||
+         _depth.exams + request.exams > _limits.max_exams ||
+         _depth.bytes + request.bytes > _limits.max_bytes)) {
+      return Admission::BUSY;
+    }
+    _depth.requests++;
+    _depth.exams += request.exams;
+    _depth.bytes += request.bytes;
+    request.admitted = std::chrono::steady_clock::now();
+    _pending[static_cast<size_t>(request.priority)].push_back(
+        std::move(request));
+  }
+  _ready.notify_one();
+  return Admission::ACCEPTED;
+}
+
+bool RequestQueue::pop(PendingRequest& request) {
+  std::unique_lock lock(_mutex);
+  _ready.wait(lock, [this] {
+    return _closed || std::any_of(_pending.begin(), _pending.end(),
+                                  [](const auto& queue) {
+                                    return !queue.empty();
+                                  });
+  });
+  return _take(PRIORITY_CLASSES, request);
+}
+
+bool RequestQueue::pop_for(PendingRequest& request,
+                           std::chrono::milliseconds timeout) {
+  std::unique_lock lock(_mutex);
+  _ready.wait_for(lock, timeout, [this] {
+    return _closed || std::any_of(_pending.begin(), _pending.end(),
+                                  [](const auto& queue) {
+                                    return !queue.empty();
+                                  });
+  });
+  return _take(PRIORITY_CLASSES, request);
+}
+
+bool RequestQueue::finished() const {
+  std::lock_guard lock(_mutex);
+  return _closed &&
+         std::all_of(_pending.begin(), _pending.end(),
+                     [](const auto& queue) { return queue.empty(); });
+}
+
+bool RequestQueue::pop_above(
+    Priority priority,
+    const std::function<bool(const PendingRequest&)>& accepts,
+    PendingRequest& request) {
+  std::lock_guard lock(_mutex);
+  for (size_t level = 0; level < static_cast<size_t>(priority); level++) {
+    auto& queue = _pending[level];
+    if (!queue.empty() && accepts(queue.front())) {
+      request = std::move(queue.front());
+      queue.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+Join RequestQueue::pop_joining(
+    Priority priority, std::chrono::steady_clock::time_point deadline,
+    const std::function<bool(const PendingRequest&)>& joins,
+    PendingRequest& request) {
+  auto level = static_cast<size_t>(priority);
+  auto higher = [this, level] {
+    return std::any_of(_pending.begin(), _pending.begin() + level,
+                       [](const auto& queue) { return !queue.empty(); });
+  };
+  std::unique_lock lock(_mutex);
+  if (!_ready.wait_until(lock, deadline, [&] {
+        return _closed || !_pending[level].empty() || higher();
+      })) {
+    return Join::WAITED;
+  }
+  auto& queue = _pending[level];
+  if (_closed || higher() || queue.empty() || !joins(queue.front())) {
+    return Join::REFUSED;
+  }
+  request = std::move(queue.front());
+  queue.pop_front();
+  return Join::TAKEN;
+}
+
+bool RequestQueue::_take(size_t classes, PendingRequest& request) {
+  for (size_t level = 0; level < classes; level++) {
+    auto& queue = _pending[level];
+    if (!queue.empty()) {
+      request = std::move(queue.front());
+      queue.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void RequestQueue::release(const PendingRequest& request,
+                           std::chrono::steady_clock::duration service_time) {
+  std::lock_guard lock(_mutex);
+  _depth.requests--;
+  _depth.exams -= request.exams;
+  _depth.bytes -= request.bytes;
+  auto sample = std::chrono::duration<f64, std::milli>(service_time).count();
+  _service_ms = _service_ms == 0.0 ? sample
+                                    : SERVICE_ALPHA * sample +
+                                          (1.0 - SERVICE_ALPHA) * _service_ms;
+  auto level = static_cast<size_t>(request.priority);
+  auto latency = std::chrono::duration<f64, std::milli>(
+                     std::chrono::steady_clock::now() - request.admitted)
+                     .count();
+  auto& window = _latency[level];
+  if (window.samples.size() < LATENCY_WINDOW) {
+    window.samples.push_back(latency);
+  } else {
+    window.samples[window.next] = latency;
+  }
+  window.next = (window.next + 1) % LATENCY_WINDOW;
+  window.served++;
+  auto bound = _limits.latency_bound_ms[level];
+  if (bound > 0 && latency > bound) {
+    window.over_bound++;
+  }
+}
+
+void RequestQueue::close() {
+  {
+    std::lock_guard lock(_mutex);
+    _closed = true;
+  }
+  _ready.notify_all();
+}
+
+QueueDepth RequestQueue::depth() const {
+  std::lock_guard lock(_mutex);
+  return _depth;
+}
+
+LatencySummary RequestQueue::latency(Priority priority) const {
+  std::vector<f64> samples;
+  LatencySummary summary;
+  {
+    std::lock_guard lock(_mutex);
+    const auto& window = _latency[static_cast<size_t>(priority)];
+    samples = window.samples;
+    summary.served = window.served;
+    summary.over_bound = window.over_bound;
+  }
+  if (samples.empty()) {
+    return summary;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&samples](f64 p) {
+    return samples[static_cast<size_t>(p * (samples.size() - 1))];
+  };
+  summary.p50_ms = percentile(0.50);
+  summary.p99_ms = percentile(0.99);
+  summary.max_ms = samples.back();
+  return summary;
+}
+
+u32 RequestQueue::retry_after_ms() const {
+  std::lock_guard lock(_mutex);
+  // until a request has been served, assume they take MIN_RETRY_MS each
+  auto wait = std::max(_service_ms, MIN_RETRY_MS) *
+              std::max(_depth.requests, u32{1});
+  return static_cast<u32>(std::ceil(wait));
+}
@@ -0,0 +1,196 @@
+#pragma once
+#ifndef REQUEST_QUEUE_HPP
+#define REQUEST_QUEUE_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <domain/scheduler.hpp>
+#include <functional>
+#include <mutex>
+#include <server/protocol.hpp>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Admission limits of the request queue
+ * @details A request counts against the limits from the moment it is admitted
+ *          until its response is sent, so the request being served counts too.
+ */
+struct QueueLimits {
+  u32 max_requests = 64;            /** Requests admitted at once */
+  u64 max_exams = 200000;           /** Exams in the admitted requests */
+  u64 max_bytes = 64 * 1024 * 1024; /** Payload bytes of those requests */
+  /** Latency target of each priority class, 0 for none */
+  std::array<u32, PRIORITY_CLASSES> latency_bound_ms = {250, 0, 0};
+};
+
+/**
+ * @brief What the admitted requests hold right now
+ */
+struct QueueDepth {
+  u32 requests = 0;
+  u64 exams = 0;
+  u64 bytes = 0;
+};
+
+/**
+ * @brief Latency of the served requests of a priority class
+ * @details From admission to response, percentiles over the latest
+ *          LATENCY_WINDOW requests.
+ */
+struct LatencySummary {
+  u64 served = 0;     /** Requests served since start */
+  u64 over_bound = 0; /** Of those, served later than the class bound */
+  f64 p50_ms = 0.0;
+  f64 p99_ms = 0.0;
+  f64 max_ms = 0.0;
+};
+
+/**
+ * @brief A request read from a client, waiting for the server loop
+ */
+struct PendingRequest {
+  i32 client_fd;            /** Socket the response goes to */
+  ScoreHiveRequest request; /** Parsed request */
+  u64 exams;                /** Exams in the payload */
+  u64 bytes;                /** Payload size */
+  Priority priority;        /** Class of a review, NORMAL otherwise */
+  std::chrono::steady_clock::time_point admitted;
+  i32 frontend = -1;        /** Front-end that relayed it, -1 if none */
+  u64 relay = 0;            /** Relay id the front-end gave it */
+  i32 top_k = 0;            /** Relayed RANK: best exams kept per stage */
+  /** Relayed in binary form: the exams of a REVIEW or RANK in ExamCodec
+   *  form, or a result store query */
+  bool encoded = false;
+};
+
+/**
+ * @brief Outcome of RequestQueue::push()
+ */
+enum class Admission : u8 {
+  ACCEPTED = 0, /** Queued, the server loop will answer it */
+  BUSY = 1,     /** Over a limit, the client should retry later */
+  CLOSED = 2,   /** The server is shutting down */
+};
+
+/**
+ * @brief Outcome of RequestQueue::pop_joining()
+ */
+enum class Join : u8 {
+  TAKEN = 0,   /** The next request of the class joins */
+  WAITED = 1,  /** None came before the deadline */
+  REFUSED = 2, /** It cannot join, or a higher class or the close came first */
+};
+
+/**
+ * @brief Bounded queue between the acceptor thread and the server loop
+ * @details The acceptor reads and admits requests while the server loop is
+ *          busy with the previous one. Requests over the limits are refused
+ *          on the spot instead of piling up in the listen backlog, and the
+ *          time the server loop takes per request gives clients a hint of
+ *          when to retry. Requests are served by priority class, in the order
+ *          they came within a class.
+ */
+class RequestQueue {
+ public:
+  explicit RequestQueue(const QueueLimits& limits = QueueLimits());
+
+  /**
+   * @brief Admit a request if it fits in the limits
+   * @details A request alone over the exam or byte limit is still admitted
+   *          when the queue is empty, otherwise it could never be served.
+   */
+  Admission push(PendingRequest request);
+
+  /**
+   * @brief Wait for the next request
+   * @return False once the queue is closed and empty
+   */
+  bool pop(PendingRequest& request);
+
+  /**
+   * @brief Wait at most `timeout` for the next request
+   * @return False if none came in time or the queue is closed and empty
+   */
+  bool pop_for(PendingRequest& request, std::chrono::milliseconds timeout);
+
+  /**
+   * @brief Whether the queue is closed and every request was taken
+   */
+  bool finished() const;
+
+  /**
+   * @brief Take the next request of a priority strictly above `priority`
+   *        that `accepts` lets through
+   * @details Only the next request of each class is considered, a class
+   *          whose next request is refused keeps its order and is skipped.
+   * @return False, without waiting, if there is none
+   */
+  bool pop_above(Priority priority,
+                 const std::function<bool(const PendingRequest&)>& accepts,
+                 PendingRequest& request);
+
+  /**
+   * @brief Take the next request of `priority` if `joins` accepts it
+   * @details Waits until `deadline` for one to come. Only the next request
+   *          of the class is considered, so the class keeps its order, and
+   *          nothing is taken while a request of a higher class waits.
+   */
+  Join pop_joining(Priority priority,
+                   std::chrono::steady_clock::time_point deadline,
+                   const std::function<bool(const PendingRequest&)>& joins,
+                   PendingRequest& request);
+
+  /**
+   * @brief Give back the budget of a served request
+   * @param service_time Time it took to serve it
+   */
+  void release(const PendingRequest& request,
+               std::chrono::steady_clock::duration service_time);
+
+  /**
+   * @brief Refuse every new request, the queued ones can still be popped
+   */
+  void close();
+
+  const QueueLimits& limits() const { return _limits; }
+
+  QueueDepth depth() const;
+
+  /**
+   * @brief Time until the requests admitted now are expected to be served
+   */
+  u32 retry_after_ms() const;
+
+  LatencySummary latency(Priority priority) const;
+
+ private:
+  static constexpr f64 SERVICE_ALPHA = 0.2; /** EWMA weight of a new sample */
+  static constexpr f64 MIN_RETRY_MS = 10.0;
+  static constexpr size_t LATENCY_WINDOW = 1024;
+
+  /**
+   * @brief Latest latencies of a priority class, as a ring buffer
+   */
+  struct LatencyWindow {
+    std::vector<f64> samples;
+    size_t next = 0;
+    u64 served = 0;
+    u64 over_bound = 0;
+  };
+
+  QueueLimits _limits;
+  mutable std::mutex _mutex;
+  std::condition_variable _ready;
+  std::array<std::deque<PendingRequest>, PRIORITY_CLASSES> _pending;
+  std::array<LatencyWindow, PRIORITY_CLASSES> _latency;
+  QueueDepth _depth;
+  f64 _service_ms = 0.0; /** EWMA of the time to serve a request */
+  bool _closed = false;
+
+  bool _take(size_t classes, PendingRequest& request);
+};
+
+#endif  // REQUEST_QUEUE_HPP
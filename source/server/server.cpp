@@ -1,19 +1,244 @@
 #include "server.hpp"
-#include <mpi.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <domain/answers.hpp>
 #include <domain/coordinator.hpp>
+#include <domain/ranking.hpp>
+#include <domain/result_store.hpp>
+#include <domain/scheduler.hpp>
+#include <map>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <server/frontend.hpp>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system/topology.hpp>
+#include <thread>
+#include <vector>
 
-using json = nlohmann::json;
+namespace {
 
-Server::Server(const ServerConfig& config) : _config(config) {}
+constexpr std::string_view BLANKS = " \t\r\n";
+
+/**
+ * @brief Position just past the JSON string that starts at pos
+ */
+size_t skip_string(std::string_view data, size_t pos) {
+  for (pos++; pos < data.size(); pos++) {
+    if (data[pos] == '\\') {
+      pos++;
+    } else if (data[pos] == '"') {
+      return pos + 1;
+    }
+  }
+  return std::string_view::npos;
+}
+
+/**
+ * @brief Position of the value of a top-level key of a JSON object
+ * @details Strings and nested values are stepped over, so the same key
+ *          deeper in the payload, or inside a string, is never taken.
+ */
+size_t top_level_value(std::string_view data, std::string_view key) {
+  auto pos = data.find_first_not_of(BLANKS);
+  if (pos == std::string_view::npos || data[pos] != '{') {
+    return std::string_view::npos;
+  }
+  i32 depth = 0;
+  while (pos < data.size()) {
+    auto c = data[pos];
+    if (c == '"') {
+      auto end = skip_string(data, pos);
+      if (end == std::string_view::npos) {
+        return end;
+      }
+      if (depth == 1 && data.substr(pos + 1, end - pos - 2) == key) {
+        auto colon = data.find_first_not_of(BLANKS, end);
+        if (colon != std::string_view::npos && data[colon] == ':') {
+          return data.find_first_not_of(BLANKS, colon + 1);
+        }
+      }
+      pos = end;
+      continue;
+    }
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      break;
+    }
+    pos++;
+  }
+  return std::string_view::npos;
+}
+
+/**
+ * @brief Elements of the JSON array that starts at pos
+ * @details Counts the commas between its direct elements. A malformed array
+ *          gets a rough count, its parse rejects the request anyway.
+ */
+u64 count_elements(std::string_view data, size_t pos) {
+  if (pos == std::string_view::npos || data[pos] != '[') {
+    return 0;
+  }
+  u64 commas = 0;
+  bool empty = true;
+  i32 depth = 0;
+  while (pos < data.size()) {
+    auto c = data[pos];
+    if (depth == 1 && BLANKS.find(c) == std::string_view::npos &&
+        c != ']') {
+      empty = false;
+    }
+    if (c == '"') {
+      pos = skip_string(data, pos);
+      continue;
+    }
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      break;
+    } else if (depth == 1 && c == ',') {
+      commas++;
+    }
+    pos++;
+  }
+  return empty ? 0 : commas + 1;
+}
+
+/**
+ * @brief Exams in a REVIEW or RANK payload
+ * @details Sized from the exams array for admission without parsing it.
+ */
+u64 count_exams(const ScoreHiveRequest& request) {
+  if (request.command != ScoreHiveCommand::REVIEW &&
+      request.command != ScoreHiveCommand::RANK) {
+    return 0;
+  }
+  std::string_view data = request.data;
+  auto pos = data.find_first_not_of(BLANKS);
+  if (pos != std::string_view::npos && data[pos] == '{') {
+    pos = top_level_value(data, "exams");
+  }
+  return count_elements(data, pos);
+}
+
+/**
+ * @brief Priority class of a REVIEW or RANK payload
+ * @details Only the object form {"exams": [...], "priority": ...} carries one.
+ *          The queue only needs it for ordering, so the top-level key is
+ *          looked up without parsing the exams; the handler parses it for
+ *          real.
+ */
+Priority request_priority(const ScoreHiveRequest& request) {
+  if (request.command != ScoreHiveCommand::REVIEW &&
+      request.command != ScoreHiveCommand::RANK) {
+    return Priority::NORMAL;
+  }
+  std::string_view data = request.data;
+  auto pos = top_level_value(data, "priority");
+  if (pos == std::string_view::npos || data[pos] != '"') {
+    return Priority::NORMAL;
+  }
+  auto end = skip_string(data, pos);
+  if (end == std::string_view::npos) {
+    return Priority::NORMAL;
+  }
+  return json(std::string(data.substr(pos + 1, end - pos - 2)))
+      .get<Priority>();
+}
+
+ScoreHiveResponse make_response(ScoreHiveResponseCode code, std::string data) {
+  ScoreHiveResponse response;
+  response.code = code;
+  response.length = data.size();
+  response.data = std::move(data);
+  return response;
+}
+
+/**
+ * @brief Prefix of the errors of a command, as its handler writes them
+ */
+std::string error_label(ScoreHiveCommand command) {
+  switch (command) {
+    case ScoreHiveCommand::REVIEW:
+      return "Review Error: ";
+    case ScoreHiveCommand::RANK:
+      return "Rank Error: ";
+    case ScoreHiveCommand::FETCH_RESULTS:
+      return "Fetch Results Error: ";
+    case ScoreHiveCommand::PAGE_RESULTS:
+      return "Page Results Error: ";
+    case ScoreHiveCommand::TOP_RESULTS:
+      return "Top Results Error: ";
+    default:
+      return "Relay Error: ";
+  }
+}
+
+/**
+ * @brief Append records to relay data, in native byte order
+ */
+template <typename T>
+void pack(std::span<const T> records, std::string& data) {
+  data.append(reinterpret_cast<const char*>(records.data()),
+              records.size_bytes());
+}
+
+/**
+ * @brief Records of relay data
+ * @throws std::runtime_error if it does not hold whole records
+ */
+template <typename T>
+std::vector<T> unpack(std::string_view data) {
+  if (data.size() % sizeof(T) != 0) {
+    throw std::runtime_error("Malformed relay data");
+  }
+  std::vector<T> records(data.size() / sizeof(T));
+  std::memcpy(records.data(), data.data(), data.size());
+  return records;
+}
+
+/**
+ * @brief Results with the score histogram of their stages, as relay data
+ */
+std::string pack_ranked(std::span<const MPIResult> results,
+                        std::span<const ScoreCount> counts) {
+  std::string data;
+  u64 size = results.size();
+  pack(std::span<const u64>(&size, 1), data);
+  pack(results, data);
+  pack(counts, data);
+  return data;
+}
+
+void unpack_ranked(std::string_view data, std::vector<MPIResult>& results,
+                   std::vector<ScoreCount>& counts) {
+  u64 size = 0;
+  if (data.size() < sizeof(size)) {
+    throw std::runtime_error("Malformed relay data");
+  }
+  std::memcpy(&size, data.data(), sizeof(size));
+  data.remove_prefix(sizeof(size));
+  if (size > data.size() / sizeof(MPIResult)) {
+    throw std::runtime_error("Malformed relay data");
+  }
+  results = unpack<MPIResult>(data.substr(0, size * sizeof(MPIResult)));
+  counts = unpack<ScoreCount>(data.substr(size * sizeof(MPIResult)));
+}
+
+}  // namespace
+
+Server::Server(const ServerConfig& config)
+    : _config(config), _queue(config.queue) {}
 
 void Server::start() {
   spdlog::info("Starting server...");
@@ -25,7 +250,6 @@ void Server::start() {
   if (socket_fd == -1) {
     _handle_error();
   }
-  MPI_Comm_size(MPI_COMM_WORLD, &_mpi_size);
   sockaddr_in address = {
       .sin_family = AF_INET,            // IPv4
       .sin_port = htons(_config.port),  // Port 8080
@@ -33,6 +257,14 @@ void Server::start() {
       .sin_zero = {0}                   // Pad to size of `struct sockaddr'
   };
   sockaddr* address_ptr = reinterpret_cast<sockaddr*>(&address);
+  if (_config.reuse_port) {
+    // the kernel spreads the clients over the front-ends of the host
+    i32 enable = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                   sizeof(enable)) == -1) {
+      _handle_error();
+    }
+  }
   // Bind the socket to the address and port
   auto bind_result = bind(socket_fd, address_ptr, sizeof(address));
   if (bind_result == -1) {
@@ -43,84 +275,412 @@ void Server::start() {
   if (listen_result == -1) {
     _handle_error();
   }
-  while (!_shutdown) {
-    spdlog::info("Server waiting for client on port 8080");
-    // Accept an incoming connection
-    auto accept_result = accept(socket_fd, nullptr, nullptr);
-    if (accept_result == -1) {
-      _handle_error();
-      continue;
+  if (!_config.capture_path.empty()) {
+    _capture = std::make_unique<TrafficWriter>(_config.capture_path);
+    spdlog::info("Capturing requests to {}", _config.capture_path);
+  }
+  _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wake_fd == -1) {
+    _handle_error();
+  }
+  spdlog::info("Server waiting for clients on port {}", _config.port);
+  std::thread acceptor(&Server::_accept_loop, this, socket_fd);
+  Scheduler::instance().set_preemption(
+      [this](Priority running) { _preempt(running); });
+  PendingRequest pending;
+  while (_next(pending)) {
+    if (_batches(pending)) {
+      _serve_batch(pending);
+    } else {
+      _serve(pending);
+    }
+    if (_shutdown) {
+      // the acceptor stops at its next poll, the requests already queued
+      // are still answered
+      _queue.close();
+    }
+  }
+  // the acceptor stops once it has sent what is left of the responses
+  _served = true;
+  eventfd_write(_wake_fd, 1);
+  acceptor.join();
+  FrontendGroup::instance().stop();
+  close(_wake_fd);
+  close(socket_fd);
+}
+
+bool Server::_next(PendingRequest& pending) {
+  if (!FrontendGroup::instance().enabled()) {
+    return _queue.pop(pending);
+  }
+  // only this thread talks to MPI, so it waits on the queue in short slices
+  while (!_queue.finished() || !_relays.empty()) {
+    _poll_frontends();
+    if (_queue.finished() || _relays.size() >= _config.max_relays) {
+      std::this_thread::sleep_for(FRONTEND_POLL_INTERVAL);
+    } else if (_queue.pop_for(pending, FRONTEND_POLL_INTERVAL)) {
+      return true;
     }
-    // Set the client socket file descriptor
-    _client_socket_fd = accept_result;
-    auto read_result = _read();
-    if (!read_result) {
-      _parse_response();
-      auto response = _parse_response();
-      auto send_result =
-          send(_client_socket_fd, response.c_str(), response.size(), 0);
-      if (send_result == -1) {
-        _handle_error();
+  }
+  return false;
+}
+
+void Server::_poll_frontends() {
+  auto& frontends = FrontendGroup::instance();
+  if (!frontends.enabled()) {
+    return;
+  }
+  if (!frontends.primary()) {
+    u64 relay = 0;
+    ScoreHiveResponse response;
+    while (frontends.collect(relay, response)) {
+      auto it = _relays.find(relay);
+      if (it == _relays.end()) {
+        spdlog::error("Reply to unknown relay {}", relay);
+        continue;
       }
-      close(_client_socket_fd);
-      continue;
+      _finish_relay(it->second, std::move(response));
+      _relays.erase(it);
+    }
+    if (!_shutdown && frontends.stopping()) {
+      spdlog::info("Primary front-end is shutting down");
+      _shutdown = true;
+      _queue.close();
+    }
+    return;
+  }
+  PendingRequest pending;
+  while (frontends.receive(pending)) {
+    auto frontend = pending.frontend;
+    auto relay = pending.relay;
+    if (auto refusal = _enqueue(std::move(pending))) {
+      frontends.reply(frontend, relay, *refusal);
     }
+  }
+}
+
+void Server::_serve(PendingRequest& pending) {
+  auto& frontends = FrontendGroup::instance();
+  if (!_shutdown && frontends.enabled() && !frontends.primary()) {
+    _relay(pending);
+    return;
+  }
+  auto started = std::chrono::steady_clock::now();
+  _client_socket_fd = pending.client_fd;
+  _request = std::move(pending.request);
+  if (_shutdown) {
+    _response = make_response(ScoreHiveResponseCode::ERROR,
+                              "Server is shutting down");
+  } else if (pending.encoded) {
+    _handle_relayed(pending);
+  } else {
     spdlog::debug("Request received from client");
     _handle_request();
-    auto response = _parse_response();
-    auto send_result =
-        send(_client_socket_fd, response.c_str(), response.size(), 0);
-    if (send_result == -1) {
-      _handle_error();
-      close(_client_socket_fd);
+  }
+  _respond(pending, std::move(_response));
+  _queue.release(pending, std::chrono::steady_clock::now() - started);
+}
+
+bool Server::_batches(const PendingRequest& pending) const {
+  auto& frontends = FrontendGroup::instance();
+  return !_shutdown && pending.request.command == ScoreHiveCommand::REVIEW &&
+         pending.exams < _config.batch_max_exams &&
+         (!frontends.enabled() || frontends.primary()) &&
+         !Scheduler::instance().scores_locally(pending.exams);
+}
+
+void Server::_serve_batch(PendingRequest& first) {
+  auto started = std::chrono::steady_clock::now();
+  auto priority = first.priority;
+  auto exams = first.exams;
+  auto deadline =
+      first.admitted + std::chrono::microseconds(_config.batch_window_us);
+  std::vector<PendingRequest> batch;
+  batch.push_back(std::move(first));
+  auto joins = [this, &exams](const PendingRequest& next) {
+    return _batches(next) && exams + next.exams <= _config.batch_max_exams;
+  };
+  const bool polling = FrontendGroup::instance().enabled();
+  while (exams < _config.batch_max_exams) {
+    // relayed reviews join too, so the wait is sliced like in _next()
+    _poll_frontends();
+    auto until = deadline;
+    if (polling) {
+      until = std::min(deadline, std::chrono::steady_clock::now() +
+                                     FRONTEND_POLL_INTERVAL);
+    }
+    PendingRequest next;
+    auto join = _queue.pop_joining(priority, until, joins, next);
+    if (join == Join::TAKEN) {
+      exams += next.exams;
+      batch.push_back(std::move(next));
       continue;
     }
-    spdlog::debug("Response sent to client");
-    close(_client_socket_fd);  // Close the client socket
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    // Sleep for 100ms to avoid busy-waiting
+    if (join == Join::REFUSED ||
+        std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+  }
+  if (batch.size() == 1) {
+    _serve(batch.front());
+    return;
+  }
+  spdlog::debug("Reviewing {} requests of {} exams together", batch.size(),
+                exams);
+  std::vector<ScoreHiveResponse> responses(batch.size());
+  std::vector<std::optional<size_t>> sizes(batch.size());
+  std::vector<MPIExam> all;
+  for (size_t i = 0; i < batch.size(); i++) {
+    try {
+      auto part = _review_exams(batch[i]);
+      sizes[i] = part.size();
+      std::move(part.begin(), part.end(), std::back_inserter(all));
+    } catch (std::exception& e) {
+      std::string message = "Review Error: " + std::string(e.what());
+      spdlog::error(message);
+      responses[i] = make_response(ScoreHiveResponseCode::ERROR, message);
+    }
+  }
+  try {
+    auto results = Scheduler::instance().review(std::move(all), priority);
+    size_t offset = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!sizes[i]) {
+        continue;
+      }
+      std::span<const MPIResult> part(results.data() + offset, *sizes[i]);
+      offset += part.size();
+      if (batch[i].encoded) {
+        std::string data(reinterpret_cast<const char*>(part.data()),
+                         part.size_bytes());
+        responses[i] =
+            make_response(ScoreHiveResponseCode::OK, std::move(data));
+      } else {
+        auto msg = json(std::vector(part.begin(), part.end())).dump();
+        responses[i] = make_response(ScoreHiveResponseCode::OK, std::move(msg));
+      }
+    }
+  } catch (std::exception& e) {
+    std::string message = "Review Error: " + std::string(e.what());
+    spdlog::error(message);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (sizes[i]) {
+        responses[i] = make_response(ScoreHiveResponseCode::ERROR, message);
+      }
+    }
+  }
+  // each review is charged its share of the round
+  auto elapsed = (std::chrono::steady_clock::now() - started) / batch.size();
+  for (size_t i = 0; i < batch.size(); i++) {
+    _respond(batch[i], std::move(responses[i]));
+    _queue.release(batch[i], elapsed);
   }
 }
 
-void Server::_handle_error() {
-  auto error_string = std::string(strerror(errno));
-  spdlog::error("Failed to create socket: {}", error_string);
-  throw std::runtime_error(error_string);
+std::vector<MPIExam> Server::_review_exams(
+    const PendingRequest& pending) const {
+  if (pending.encoded) {
+    return FrontendGroup::decode(pending.request, pending.exams);
+  }
+  auto data = json::parse(pending.request.data);
+  if (data.is_object()) {
+    data = std::move(data.at("exams"));
+  }
+  return MPICoordinator::instance().parse_exams(data);
 }
 
-bool Server::_read() {
-  try {
-    std::string message;
-    buffer<1024> buffer;
-    // Read the message until the delimiter is found ('$' defined in the protocol)
-    while (message.find('$') == std::string::npos) {
-      auto recv_result =
-          recv(_client_socket_fd, buffer.data(), buffer.size(), 0);
-      if (recv_result == -1) {
-        _handle_error();
+void Server::_respond(const PendingRequest& pending,
+                      ScoreHiveResponse response) {
+  if (pending.frontend >= 0) {
+    FrontendGroup::instance().reply(pending.frontend, pending.relay, response);
+  } else {
+    _reply(pending.client_fd, std::move(response));
+  }
+  spdlog::debug("Response sent to client");
+}
+
+void Server::_preempt(Priority running) {
+  _poll_frontends();
+  auto reviews = [](const PendingRequest& pending) {
+    return pending.request.command == ScoreHiveCommand::REVIEW ||
+           pending.request.command == ScoreHiveCommand::RANK;
+  };
+  PendingRequest pending;
+  while (!_shutdown && _queue.pop_above(running, reviews, pending)) {
+    // the preempted request is resumed once this one is answered
+    auto client_socket_fd = _client_socket_fd;
+    auto request = std::move(_request);
+    auto response = std::move(_response);
+    _serve(pending);
+    _client_socket_fd = client_socket_fd;
+    _request = std::move(request);
+    _response = std::move(response);
+  }
+}
+
+void Server::_accept_loop(i32 socket_fd) {
+  Topology::instance().place_io_thread();
+  std::map<i32, Connection> connections;  // clients still sending
+  std::map<i32, Outgoing> writes;         // clients still reading
+  std::vector<pollfd> fds;
+  while (true) {
+    // read first: a response handed over before it was set is taken below
+    const bool served = _served;
+    _send_outgoing(writes, {});
+    if (_shutdown) {
+      // requests still being received are never answered
+      for (const auto& [client_fd, connection] : connections) {
+        close(client_fd);
       }
-      if (recv_result == 0) {
-        spdlog::error("Connection closed by client");
-        return false;
+      connections.clear();
+      if (served && writes.empty()) {
+        break;
+      }
+    }
+    fds.clear();
+    fds.push_back({.fd = _wake_fd, .events = POLLIN, .revents = 0});
+    if (!_shutdown && connections.size() < _config.max_connections) {
+      fds.push_back({.fd = socket_fd, .events = POLLIN, .revents = 0});
+    }
+    for (const auto& [client_fd, connection] : connections) {
+      fds.push_back({.fd = client_fd, .events = POLLIN, .revents = 0});
+    }
+    for (const auto& [client_fd, outgoing] : writes) {
+      fds.push_back({.fd = client_fd, .events = POLLOUT, .revents = 0});
+    }
+    if (poll(fds.data(), fds.size(), POLL_INTERVAL_MS) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("Failed to poll clients: {}", strerror(errno));
+      break;
+    }
+    auto now = std::chrono::steady_clock::now();
+    _send_outgoing(writes, fds);
+    for (const auto& entry : fds) {
+      if (entry.revents == 0 || entry.events == POLLOUT) {
+        continue;
       }
-      message.append(buffer.data(), recv_result);
-      if (message.size() > _config.max_message_size) {
-        spdlog::error("Message size exceeds the maximum allowed size");
+      if (entry.fd == _wake_fd) {
+        eventfd_t ignored = 0;
+        eventfd_read(_wake_fd, &ignored);
+        continue;
+      }
+      if (entry.fd == socket_fd) {
+        // Accept an incoming connection
+        auto client_fd = accept4(socket_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (client_fd == -1) {
+          spdlog::error("Failed to accept client: {}", strerror(errno));
+          continue;
+        }
+        connections[client_fd].deadline =
+            now + std::chrono::milliseconds(_config.read_timeout_ms);
+        continue;
+      }
+      auto& connection = connections[entry.fd];
+      try {
+        if (!_read(entry.fd, connection.message)) {
+          continue;
+        }
+        if (_capture) {
+          _capture->record(connection.message);
+        }
+        _admit(entry.fd, connection.message);
+      } catch (std::exception& e) {
+        spdlog::error("Failed to read data: {}", e.what());
+        _reply(entry.fd, make_response(ScoreHiveResponseCode::ERROR, e.what()));
+      }
+      connections.erase(entry.fd);
+    }
+    // a stalled client must not hold its connection forever
+    std::erase_if(connections, [this, now](const auto& item) {
+      if (item.second.deadline > now) {
         return false;
       }
+      spdlog::error("Client did not send its request in time");
+      _reply(item.first, make_response(ScoreHiveResponseCode::ERROR,
+                                       "Request timed out"));
+      return true;
+    });
+    if (_capture) {
+      _capture->flush();
     }
-    _parse_request(message);
-    return true;
-  } catch (std::exception& e) {
-    spdlog::error("Failed to read data: {}", e.what());
-    _response.code = ScoreHiveResponseCode::ERROR;
-    _response.length = strlen(e.what());
-    _response.data = e.what();
-    return false;
+  }
+  for (const auto& [client_fd, connection] : connections) {
+    close(client_fd);
+  }
+  for (const auto& [client_fd, outgoing] : writes) {
+    close(client_fd);
+  }
+  if (_capture) {
+    _capture->flush();
+    spdlog::info("Captured {} requests to {}", _capture->records(),
+                 _config.capture_path);
   }
 }
 
-void Server::_parse_request(const std::string& message) {
+void Server::_admit(i32 client_fd, const std::string& message) {
+  PendingRequest pending;
+  _parse_request(message, pending.request);
+  if (pending.request.command == ScoreHiveCommand::STATUS) {
+    _reply(client_fd, make_response(ScoreHiveResponseCode::OK,
+                                    _queue_status(true).dump()));
+    return;
+  }
+  pending.client_fd = client_fd;
+  pending.exams = count_exams(pending.request);
+  pending.bytes = pending.request.data.size();
+  pending.priority = request_priority(pending.request);
+  if (auto refusal = _enqueue(std::move(pending))) {
+    _reply(client_fd, *refusal);
+  }
+}
+
+std::optional<ScoreHiveResponse> Server::_enqueue(PendingRequest pending) {
+  switch (_queue.push(std::move(pending))) {
+    case Admission::ACCEPTED:
+      return std::nullopt;
+    case Admission::BUSY: {
+      auto status = _queue_status(false);
+      status["retry_after_ms"] = _queue.retry_after_ms();
+      spdlog::warn("Request queue full, request refused");
+      return make_response(ScoreHiveResponseCode::BUSY, status.dump());
+    }
+    case Admission::CLOSED:
+      break;
+  }
+  return make_response(ScoreHiveResponseCode::ERROR, "Server is shutting down");
+}
+
+void Server::_handle_error() {
+  auto error_string = std::string(strerror(errno));
+  spdlog::error("Failed to create socket: {}", error_string);
+  throw std::runtime_error(error_string);
+}
+
+bool Server::_read(i32 client_fd, std::string& message) const {
+  buffer<READ_BUFFER_SIZE> buffer;
+  auto recv_result = recv(client_fd, buffer.data(), buffer.size(), 0);
+  if (recv_result == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return false;  // nothing to read after all, wait for the next poll
+    }
+    throw std::runtime_error(strerror(errno));
+  }
+  if (recv_result == 0) {
+    throw std::runtime_error("Connection closed by client");
+  }
+  message.append(buffer.data(), recv_result);
+  if (message.size() > _config.max_message_size) {
+    throw std::runtime_error("Message size exceeds the maximum allowed size");
+  }
+  // Read the message until the delimiter is found ('$' defined in the protocol)
+  return std::memchr(message.data() + message.size() - recv_result, '$',
+                     recv_result) != nullptr;
+}
+
+void Server::_parse_request(const std::string& message,
+                            ScoreHiveRequest& request) const {
   std::istringstream iss(message);
   std::string token;
   if (!std::getline(iss, token, ' ') || token != "SH") {
@@ -130,23 +690,36 @@ void Server::_parse_request(const std::string& message) {
     throw std::runtime_error("Missing command");
   }
   size_t pos = token.find('$');
-  if (pos != std::string::npos) {
+  const bool bare = pos != std::string::npos;  // "SH <command>$"
+  if (bare) {
     token = token.substr(0, pos);
   }
   u8 command = static_cast<u8>(std::stoi(token));
   if (command > MAX_COMMAND) {
     throw std::runtime_error("Invalid command");
   }
-  if (command == 0) {
-    _request.command = ScoreHiveCommand::GET_ANSWERS;
-    _request.length = 0;
-    _request.data = "";
+  if (command == 0 && bare) {
+    request.command = ScoreHiveCommand::GET_ANSWERS;
+    request.length = 0;
+    request.data = "";
     return;
   }
   if (command == 4) {
-    _request.command = ScoreHiveCommand::SHUTDOWN;
-    _request.length = 0;
-    _request.data = "";
+    request.command = ScoreHiveCommand::SHUTDOWN;
+    request.length = 0;
+    request.data = "";
+    return;
+  }
+  if (command == 7) {
+    request.command = ScoreHiveCommand::ANALYTICS;
+    request.length = 0;
+    request.data = "";
+    return;
+  }
+  if (command == 9) {
+    request.command = ScoreHiveCommand::STATUS;
+    request.length = 0;
+    request.data = "";
     return;
   }
   if (!std::getline(iss, token, ' ')) {
@@ -162,9 +735,9 @@ void Server::_parse_request(const std::string& message) {
   if (token.size() != length) {
     throw std::runtime_error("Data length mismatch");
   }
-  _request.command = static_cast<ScoreHiveCommand>(command);
-  _request.length = length;
-  _request.data = token;
+  request.command = static_cast<ScoreHiveCommand>(command);
+  request.length = length;
+  request.data = token;
 }
 
 void Server::_handle_request() {
@@ -184,17 +757,266 @@ void Server::_handle_request() {
     case ScoreHiveCommand::SHUTDOWN:
       _handle_shutdown();
       break;
+    case ScoreHiveCommand::ADD_WORKERS:
+      _handle_add_workers();
+      break;
+    case ScoreHiveCommand::REMOVE_WORKERS:
+      _handle_remove_workers();
+      break;
+    case ScoreHiveCommand::ANALYTICS:
+      _handle_analytics();
+      break;
+    case ScoreHiveCommand::RANK:
+      _handle_rank();
+      break;
+    case ScoreHiveCommand::PATCH_ANSWERS:
+      _handle_patch_answers();
+      break;
+    case ScoreHiveCommand::FETCH_RESULTS:
+      _handle_fetch_results();
+      break;
+    case ScoreHiveCommand::PAGE_RESULTS:
+      _handle_page_results();
+      break;
+    case ScoreHiveCommand::TOP_RESULTS:
+      _handle_top_results();
+      break;
     default:
       _handle_bad_request();
       break;
   }
 }
 
+void Server::_relay(PendingRequest& pending) {
+  auto& frontends = FrontendGroup::instance();
+  const auto& request = pending.request;
+  Relay relay;
+  relay.started = std::chrono::steady_clock::now();
+  try {
+    u64 id = 0;
+    std::string data;
+    switch (request.command) {
+      case ScoreHiveCommand::REVIEW:
+      case ScoreHiveCommand::RANK: {
+        auto exams = json::parse(request.data);
+        if (exams.is_object()) {
+          if (request.command == ScoreHiveCommand::RANK) {
+            relay.top_k = exams.value("top_k", 0);
+          }
+          exams = std::move(exams.at("exams"));
+        }
+        if (relay.top_k < 0) {
+          throw std::runtime_error("Invalid top_k");
+        }
+        auto parsed = MPICoordinator::instance().parse_exams(exams);
+        relay.count = parsed.size();
+        id = frontends.review(request.command, parsed, pending.priority,
+                              relay.top_k);
+        break;
+      }
+      case ScoreHiveCommand::FETCH_RESULTS: {
+        auto keys = _fetch_keys(request.data);
+        relay.count = keys.size();
+        pack<ResultKey>(keys, data);
+        id = frontends.query(request.command, data);
+        break;
+      }
+      case ScoreHiveCommand::PAGE_RESULTS: {
+        auto query = _page_query(request.data);
+        relay.count = query.limit;
+        pack(std::span<const PageQuery>(&query, 1), data);
+        id = frontends.query(request.command, data);
+        break;
+      }
+      case ScoreHiveCommand::TOP_RESULTS: {
+        auto query = _top_query(request.data);
+        relay.top_k = query.top_k;
+        pack(std::span<const TopQuery>(&query, 1), data);
+        id = frontends.query(request.command, data);
+        break;
+      }
+      default:
+        id = frontends.forward(request, pending.priority, pending.exams);
+        break;
+    }
+    relay.pending = std::move(pending);
+    relay.pending.request.data = std::string();
+    _relays.emplace(id, std::move(relay));
+  } catch (std::exception& e) {
+    std::string message = error_label(request.command) + e.what();
+    spdlog::error(message);
+    _respond(pending, make_response(ScoreHiveResponseCode::ERROR, message));
+    _queue.release(pending, std::chrono::steady_clock::now() - relay.started);
+  }
+}
+
+void Server::_finish_relay(Relay& relay, ScoreHiveResponse response) {
+  auto command = relay.pending.request.command;
+  // errors of the primary and forwarded replies go back as they are
+  if (response.code == ScoreHiveResponseCode::OK) {
+    try {
+      auto body = _relayed_json(relay, response.data);
+      if (!body.is_null()) {
+        response = make_response(ScoreHiveResponseCode::OK, body.dump());
+      }
+    } catch (std::exception& e) {
+      std::string message = error_label(command) + e.what();
+      spdlog::error(message);
+      response = make_response(ScoreHiveResponseCode::ERROR, message);
+    }
+  }
+  _respond(relay.pending, std::move(response));
+  _queue.release(relay.pending,
+                 std::chrono::steady_clock::now() - relay.started);
+}
+
+json Server::_relayed_json(const Relay& relay, std::string_view data) {
+  std::vector<MPIResult> results;
+  std::vector<ScoreCount> counts;
+  switch (relay.pending.request.command) {
+    case ScoreHiveCommand::REVIEW:
+      results = unpack<MPIResult>(data);
+      if (results.size() != relay.count) {
+        throw std::runtime_error("Malformed relay data");
+      }
+      return results;
+    case ScoreHiveCommand::RANK:
+    case ScoreHiveCommand::TOP_RESULTS:
+      unpack_ranked(data, results, counts);
+      if (relay.top_k == 0) {
+        return Ranking::rank(results, counts);
+      }
+      return Ranking::top(results, relay.top_k, counts);
+    case ScoreHiveCommand::FETCH_RESULTS: {
+      // a flag per key, then the results found
+      if (data.size() < relay.count) {
+        throw std::runtime_error("Malformed relay data");
+      }
+      results = unpack<MPIResult>(data.substr(relay.count));
+      std::vector<std::optional<MPIResult>> found(relay.count);
+      size_t next = 0;
+      for (size_t i = 0; i < found.size(); i++) {
+        if (data[i] == 0) {
+          continue;
+        }
+        if (next == results.size()) {
+          throw std::runtime_error("Malformed relay data");
+        }
+        found[i] = results[next++];
+      }
+      if (next != results.size()) {
+        throw std::runtime_error("Malformed relay data");
+      }
+      return _fetch_json(found);
+    }
+    case ScoreHiveCommand::PAGE_RESULTS:
+      return _page_json(unpack<MPIResult>(data),
+                        static_cast<u32>(relay.count));
+    default:
+      return nullptr;
+  }
+}
+
+void Server::_handle_relayed(const PendingRequest& pending) {
+  try {
+    auto& scheduler = Scheduler::instance();
+    std::string data;
+    std::vector<ScoreCount> counts;
+    switch (_request.command) {
+      case ScoreHiveCommand::REVIEW: {
+        auto results = scheduler.review(
+            FrontendGroup::decode(_request, pending.exams), pending.priority);
+        pack<MPIResult>(results, data);
+        break;
+      }
+      case ScoreHiveCommand::RANK: {
+        auto results =
+            scheduler.rank(FrontendGroup::decode(_request, pending.exams),
+                           pending.top_k, pending.priority, counts);
+        data = pack_ranked(results, counts);
+        break;
+      }
+      case ScoreHiveCommand::FETCH_RESULTS: {
+        auto found = _fetch(unpack<ResultKey>(_request.data));
+        std::vector<MPIResult> results;
+        for (const auto& result : found) {
+          data.push_back(result ? 1 : 0);
+          if (result) {
+            results.push_back(*result);
+          }
+        }
+        pack<MPIResult>(results, data);
+        break;
+      }
+      case ScoreHiveCommand::PAGE_RESULTS: {
+        auto query = unpack<PageQuery>(_request.data);
+        if (query.size() != 1) {
+          throw std::runtime_error("Malformed relay data");
+        }
+        pack<MPIResult>(_page(query[0]), data);
+        break;
+      }
+      case ScoreHiveCommand::TOP_RESULTS: {
+        auto query = unpack<TopQuery>(_request.data);
+        if (query.size() != 1) {
+          throw std::runtime_error("Malformed relay data");
+        }
+        auto results = _top(query[0], counts);
+        data = pack_ranked(results, counts);
+        break;
+      }
+      default:
+        _handle_bad_request();
+        return;
+    }
+    _response = make_response(ScoreHiveResponseCode::OK, std::move(data));
+  } catch (std::exception& e) {
+    std::string message = error_label(_request.command) + e.what();
+    spdlog::error(message);
+    _response = make_response(ScoreHiveResponseCode::ERROR, message);
+  }
+}
+
 void Server::_handle_get_answers() {
-  auto data = AnswersManager::instance().save_to_json();
-  _response.code = ScoreHiveResponseCode::OK;
-  _response.length = data.size();
-  _response.data = data;
+  // one snapshot, so the version and the stages always agree
+  auto answers = AnswersManager::instance().snapshot();
+  if (_request.data.empty()) {
+    auto data = answers->save_to_json();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = data.size();
+    _response.data = std::move(data);
+    return;
+  }
+  try {
+    auto query = json::parse(_request.data);
+    auto stages = query.value("stages", std::vector<i32>());
+    std::sort(stages.begin(), stages.end());
+    stages.erase(std::unique(stages.begin(), stages.end()), stages.end());
+    auto newer_than = query.value("if_newer_than", u64{0});
+    auto version = answers->version(stages);
+    auto etag = std::to_string(version);
+    if ((query.contains("if_newer_than") && version <= newer_than) ||
+        query.value("if_none_match", "") == etag) {
+      auto msg = json{{"version", version}}.dump();
+      _response.code = ScoreHiveResponseCode::NOT_MODIFIED;
+      _response.length = msg.size();
+      _response.data = std::move(msg);
+      return;
+    }
+    // the stages are spliced in as cached, never parsed back
+    auto msg = "{\"etag\":\"" + etag + "\",\"stages\":" +
+               answers->save_to_json(stages, newer_than) +
+               ",\"version\":" + etag + "}";
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Get Answers Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
 }
 
 void Server::_handle_set_answers() {
@@ -209,22 +1031,43 @@ void Server::_handle_set_answers() {
     _response.data = message;
     return;
   }
+  Scheduler::instance().reset_analytics();
   std::string message = "Set Answers OK";
   _response.code = ScoreHiveResponseCode::OK;
   _response.length = message.size();
   _response.data = message;
 }
 
+void Server::_handle_patch_answers() {
+  try {
+    AnswersManager::instance().patch_from_json(json::parse(_request.data));
+  } catch (std::exception& e) {
+    std::string message = "Patch Answers Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+    return;
+  }
+  Scheduler::instance().reset_analytics();
+  std::string message = "Patch Answers OK";
+  _response.code = ScoreHiveResponseCode::OK;
+  _response.length = message.size();
+  _response.data = message;
+}
+
 void Server::_handle_review() {
-  auto exams_json = json::parse(_request.data);
   try {
-    auto& coordinator = MPICoordinator::instance();
-    coordinator.send_to_workers(exams_json, _mpi_size);
-    auto results = coordinator.receive_results_from_workers(_mpi_size);
-    auto msg = results.dump();
+    auto data = json::parse(_request.data);
+    auto priority = Priority::NORMAL;
+    if (data.is_object()) {
+      priority = data.value("priority", Priority::NORMAL);
+      data = std::move(data.at("exams"));
+    }
+    auto msg = Scheduler::instance().review(data, priority).dump();
     _response.code = ScoreHiveResponseCode::OK;
     _response.length = msg.size();
-    _response.data = msg;
+    _response.data = std::move(msg);
   } catch (std::exception& e) {
     std::string message = "Review Error: " + std::string(e.what());
     spdlog::error(message);
@@ -239,7 +1082,7 @@ void Server::_handle_echo() {
   data = "Echo " + data;
   _response.code = ScoreHiveResponseCode::OK;
   _response.length = data.size();
-  _response.data = data;
+  _response.data = std::move(data);
 }
 
 void Server::_handle_shutdown() {
@@ -249,8 +1092,215 @@ void Server::_handle_shutdown() {
   _response.length = message.size();
   _response.data = message;
   spdlog::info(message);
+  Scheduler::instance().drain();
   auto& coordinator = MPICoordinator::instance();
-  coordinator.send_shutdown_signal(_mpi_size);
+  coordinator.send_shutdown_signal();
+}
+
+void Server::_handle_add_workers() {
+  try {
+    auto count = json::parse(_request.data).get<i32>();
+    auto workers = Scheduler::instance().add_workers(count);
+    auto msg = json{{"workers", workers}}.dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Add Workers Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+void Server::_handle_remove_workers() {
+  try {
+    auto count = json::parse(_request.data).get<i32>();
+    auto workers = Scheduler::instance().remove_workers(count);
+    auto msg = json{{"workers", workers}}.dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Remove Workers Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+void Server::_handle_analytics() {
+  auto msg = Scheduler::instance().analytics().dump();
+  _response.code = ScoreHiveResponseCode::OK;
+  _response.length = msg.size();
+  _response.data = std::move(msg);
+}
+
+void Server::_handle_rank() {
+  try {
+    auto data = json::parse(_request.data);
+    i32 top_k = 0;
+    auto priority = Priority::NORMAL;
+    if (data.is_object()) {
+      top_k = data.value("top_k", 0);
+      priority = data.value("priority", Priority::NORMAL);
+      data = std::move(data.at("exams"));
+    }
+    auto msg = Scheduler::instance().rank(data, top_k, priority).dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Rank Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+void Server::_handle_fetch_results() {
+  try {
+    _store();
+    auto msg = _fetch_json(_fetch(_fetch_keys(_request.data))).dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Fetch Results Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+void Server::_handle_page_results() {
+  try {
+    _store();
+    auto query = _page_query(_request.data);
+    auto msg = _page_json(_page(query), query.limit).dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Page Results Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+void Server::_handle_top_results() {
+  try {
+    _store();
+    auto query = _top_query(_request.data);
+    std::vector<ScoreCount> counts;
+    auto results = _top(query, counts);
+    auto msg = Ranking::top(results, query.top_k, counts).dump();
+    _response.code = ScoreHiveResponseCode::OK;
+    _response.length = msg.size();
+    _response.data = std::move(msg);
+  } catch (std::exception& e) {
+    std::string message = "Top Results Error: " + std::string(e.what());
+    spdlog::error(message);
+    _response.code = ScoreHiveResponseCode::ERROR;
+    _response.length = message.size();
+    _response.data = message;
+  }
+}
+
+std::vector<Server::ResultKey> Server::_fetch_keys(const std::string& data) {
+  std::vector<ResultKey> keys;
+  for (const auto& exam : json::parse(data)) {
+    keys.push_back(
+        {exam.at("stage").get<i32>(), exam.at("id_exam").get<i32>()});
+  }
+  return keys;
+}
+
+Server::PageQuery Server::_page_query(const std::string& data) {
+  auto parsed = json::parse(data);
+  PageQuery query{parsed.at("stage").get<i32>(), 0, 0, 0};
+  if (parsed.contains("after") && !parsed.at("after").is_null()) {
+    query.after = parsed.at("after").get<i32>();
+    query.has_after = 1;
+  }
+  query.limit = static_cast<u32>(
+      std::clamp(parsed.value("limit", DEFAULT_PAGE_RESULTS), size_t{1},
+                 MAX_PAGE_RESULTS));
+  return query;
+}
+
+Server::TopQuery Server::_top_query(const std::string& data) {
+  auto parsed = json::parse(data);
+  TopQuery query{parsed.at("stage").get<i32>(), parsed.at("top_k").get<i32>()};
+  if (query.top_k <= 0) {
+    throw std::runtime_error("Invalid top_k");
+  }
+  return query;
+}
+
+ResultStore& Server::_store() {
+  auto& store = ResultStore::instance();
+  if (!store.enabled()) {
+    throw std::runtime_error("Result store is disabled");
+  }
+  return store;
+}
+
+std::vector<std::optional<MPIResult>> Server::_fetch(
+    std::span<const ResultKey> keys) {
+  auto& store = _store();
+  std::vector<std::optional<MPIResult>> found;
+  found.reserve(keys.size());
+  for (const auto& key : keys) {
+    found.push_back(store.find(key.stage, key.id_exam));
+  }
+  return found;
+}
+
+std::vector<MPIResult> Server::_page(PageQuery query) {
+  // relayed queries were clamped by a front-end, not trusted here
+  size_t limit = std::clamp(size_t{query.limit}, size_t{1}, MAX_PAGE_RESULTS);
+  std::optional<i32> after;
+  if (query.has_after != 0) {
+    after = query.after;
+  }
+  // one more than the page tells whether another page follows
+  return _store().page(query.stage, after, limit + 1);
+}
+
+std::vector<MPIResult> Server::_top(const TopQuery& query,
+                                    std::vector<ScoreCount>& counts) {
+  if (query.top_k <= 0) {
+    throw std::runtime_error("Invalid top_k");
+  }
+  auto results = _store().stage(query.stage);
+  Ranking::count_scores(results, counts);
+  std::vector<MPIResult> selected;
+  Ranking::select_top(results, query.top_k, selected);
+  return selected;
+}
+
+json Server::_fetch_json(const std::vector<std::optional<MPIResult>>& found) {
+  json results = json::array();
+  for (const auto& result : found) {
+    results.push_back(result ? json(*result) : json(nullptr));
+  }
+  return results;
+}
+
+json Server::_page_json(std::vector<MPIResult> results, u32 limit) {
+  json next = nullptr;
+  if (results.size() > limit) {
+    results.resize(limit);
+    next = results.back().id_exam;
+  }
+  return json{{"results", results}, {"next", next}};
 }
 
 void Server::_handle_bad_request() {
@@ -259,14 +1309,153 @@ void Server::_handle_bad_request() {
   _response.data = "Bad Request";
 }
 
-std::string Server::_parse_response() {
-  std::string response = "SH";
-  response += " ";
-  response += std::to_string(static_cast<u8>(_response.code));
-  response += " ";
-  response += std::to_string(_response.length);
-  response += " ";
-  response += _response.data;
-  response += "$\r\n";
-  return response;
-}
\ No newline at end of file
+std::string Server::_response_header(const ScoreHiveResponse& response) {
+  std::string header = "SH";
+  header += " ";
+  header += std::to_string(static_cast<u8>(response.code));
+  header += " ";
+  header += std::to_string(response.length);
+  header += " ";
+  return header;
+}
+
+void Server::_reply(i32 client_fd, ScoreHiveResponse response) {
+  // header, body and trailer go out in one vectored write, straight from
+  // their buffers, so the body is never copied into a message; what the
+  // socket does not take stays in them
+  Outgoing outgoing;
+  outgoing.header = _response_header(response);
+  outgoing.body = std::move(response.data);
+  if (!_send(client_fd, outgoing)) {
+    spdlog::error("Failed to send response: {}", strerror(errno));
+    close(client_fd);
+    return;
+  }
+  if (outgoing.sent == outgoing.size()) {
+    close(client_fd);  // Close the client socket
+    return;
+  }
+  // the client reads slowly, only the acceptor thread waits for it
+  outgoing.deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(_config.write_timeout_ms);
+  {
+    std::lock_guard lock(_handed_over_mutex);
+    _handed_over.emplace_back(client_fd, std::move(outgoing));
+  }
+  eventfd_write(_wake_fd, 1);
+}
+
+void Server::_send_outgoing(std::map<i32, Outgoing>& writes,
+                            std::span<const pollfd> ready) {
+  {
+    std::lock_guard lock(_handed_over_mutex);
+    for (auto& [client_fd, outgoing] : _handed_over) {
+      writes[client_fd] = std::move(outgoing);
+    }
+    _handed_over.clear();
+  }
+  for (const auto& entry : ready) {
+    auto it = writes.find(entry.fd);
+    if (entry.revents == 0 || it == writes.end()) {
+      continue;
+    }
+    auto& outgoing = it->second;
+    bool failed = !_send(entry.fd, outgoing);
+    if (failed) {
+      spdlog::error("Failed to send response: {}", strerror(errno));
+    }
+    if (failed || outgoing.sent == outgoing.size()) {
+      close(entry.fd);
+      writes.erase(it);
+    }
+  }
+  auto now = std::chrono::steady_clock::now();
+  std::erase_if(writes, [now](const auto& item) {
+    if (item.second.deadline > now) {
+      return false;
+    }
+    spdlog::error("Client did not read its response in time");
+    close(item.first);
+    return true;
+  });
+}
+
+bool Server::_send(i32 client_fd, Outgoing& outgoing) {
+  std::array<iovec, 3> parts = {{
+      {.iov_base = outgoing.header.data(), .iov_len = outgoing.header.size()},
+      {.iov_base = outgoing.body.data(), .iov_len = outgoing.body.size()},
+      {.iov_base = const_cast<char*>(RESPONSE_TRAILER.data()),
+       .iov_len = RESPONSE_TRAILER.size()},
+  }};
+  auto skip = outgoing.sent;
+  for (auto& part : parts) {
+    auto skipped = std::min(skip, part.iov_len);
+    part.iov_base = static_cast<char*>(part.iov_base) + skipped;
+    part.iov_len -= skipped;
+    skip -= skipped;
+  }
+  auto ok = _write(client_fd, parts);
+  outgoing.sent = outgoing.size();
+  for (const auto& part : parts) {
+    outgoing.sent -= part.iov_len;
+  }
+  return ok;
+}
+
+bool Server::_write(i32 client_fd, std::span<iovec> parts) {
+  size_t first = 0;
+  while (first < parts.size()) {
+    msghdr message = {};
+    message.msg_iov = parts.data() + first;
+    message.msg_iovlen = parts.size() - first;
+    // MSG_NOSIGNAL: a client that hung up must not kill the server
+    auto sent = sendmsg(client_fd, &message, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // the socket buffer is full, the rest waits for the client
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    // skip the parts written in full and advance into the partial one
+    auto written = static_cast<size_t>(sent);
+    while (first < parts.size() && written >= parts[first].iov_len) {
+      written -= parts[first].iov_len;
+      parts[first].iov_len = 0;
+      first++;
+    }
+    if (first < parts.size()) {
+      auto& part = parts[first];
+      part.iov_base = static_cast<char*>(part.iov_base) + written;
+      part.iov_len -= written;
+    }
+  }
+  return true;
+}
+
+json Server::_queue_status(bool limits) const {
+  auto depth = _queue.depth();
+  json status = {{"queued", depth.requests},
+                 {"exams", depth.exams},
+                 {"bytes", depth.bytes}};
+  if (limits) {
+    const auto& queue_limits = _queue.limits();
+    status["limits"] = {{"requests", queue_limits.max_requests},
+                        {"exams", queue_limits.max_exams},
+                        {"bytes", queue_limits.max_bytes}};
+    json latency = json::object();
+    for (auto priority : {Priority::HIGH, Priority::NORMAL, Priority::LOW}) {
+      auto summary = _queue.latency(priority);
+      latency[json(priority).get<std::string>()] = {
+          {"served", summary.served},
+          {"p50_ms", summary.p50_ms},
+          {"p99_ms", summary.p99_ms},
+          {"max_ms", summary.max_ms},
+          {"bound_ms",
+           queue_limits.latency_bound_ms[static_cast<size_t>(priority)]},
+          {"over_bound", summary.over_bound}};
+    }
+    status["latency"] = latency;
+  }
+  return status;
+}
@@ -2,19 +2,48 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include <poll.h>
+#include <sys/uio.h>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <domain/ranking.hpp>
+#include <domain/result_store.hpp>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
 #include <server/protocol.hpp>
+#include <server/request_queue.hpp>
+#include <server/traffic_log.hpp>
+#include <span>
 #include <string>
+#include <string_view>
 #include <system/aliases.hpp>
+#include <utility>
+#include <vector>
+
+using json = nlohmann::json;
 
 /**
  * @brief Server configuration
  */
 struct ServerConfig {
   u16 port = 8080;                    /** Port to listen on */
-  u16 backlog = 10;                   /** Backlog for the listen socket */
+  u16 backlog = 128;                  /** Backlog for the listen socket */
   u32 max_message_size = 1024 * 1024; /** Maximum message size (1MB default) */
+  u32 max_connections = 256;          /** Clients read at once */
+  u32 read_timeout_ms = 5000;         /** Time a client has to send a request */
+  u32 write_timeout_ms = 5000;        /** Time a client has to read a reply */
+  QueueLimits queue;                  /** Request queue admission limits */
+  std::string capture_path;           /** Capture of the requests, or none */
+  bool reuse_port = false;            /** Share the port with other ranks */
+  /** Time a small review waits for others to join it, 0 to only join those
+   *  already queued; reviews scored on the master never wait */
+  u32 batch_window_us = 2000;
+  u32 batch_max_exams = 256; /** Exams of the reviews served together, 0 off */
+  u32 max_relays = 16; /** Requests a front-end has at the primary at once */
 };
 
 /**
@@ -31,9 +60,12 @@ class Server {
   /**
    * @brief Start the server
    * @note This function will block until the server is shutdown
-   * @details Starts a loop that accepts client connections and handles requests
-   *           until the server is shutdown. this server only handles one client
-   *           at a time.
+   * @details Starts an acceptor thread that reads requests into a bounded
+   *          queue, and serves the queue one request at a time until the
+   *          server is shutdown. Requests that do not fit in the queue get a
+   *          BUSY response right away. Only the serving thread talks to MPI,
+   *          and it never waits on a client: what a client does not read
+   *          right away is sent by the acceptor thread.
    */
   void start();
 
@@ -53,24 +85,244 @@ class Server {
   void _handle_error();
 
   /**
-   * @brief Read data from the client
-   * @return True if the read was successful, false otherwise
+   * @brief Client whose request is still being received
+   */
+  struct Connection {
+    std::string message;                            /** Bytes received so far */
+    std::chrono::steady_clock::time_point deadline; /** Read timeout */
+  };
+
+  /**
+   * @brief Response that the client has not read in full yet
+   */
+  struct Outgoing {
+    std::string header;                             /** _response_header() */
+    std::string body;                               /** Moved from response */
+    size_t sent = 0; /** Bytes of header, body and trailer sent */
+    std::chrono::steady_clock::time_point deadline; /** Write timeout */
+
+    size_t size() const {
+      return header.size() + body.size() + RESPONSE_TRAILER.size();
+    }
+  };
+
+  /**
+   * @brief Request a front-end relayed to the primary, waiting for its reply
+   */
+  struct Relay {
+    PendingRequest pending; /** Client and queue accounting, no payload */
+    i32 top_k = 0;          /** RANK and TOP_RESULTS */
+    u64 count = 0;          /** REVIEW exams, FETCH keys or PAGE limit */
+    std::chrono::steady_clock::time_point started;
+  };
+
+  /**
+   * @brief Exam of a FETCH_RESULTS request
+   */
+  struct ResultKey {
+    i32 stage;
+    i32 id_exam;
+  };
+
+  /**
+   * @brief PAGE_RESULTS request
+   */
+  struct PageQuery {
+    i32 stage;
+    i32 after;     /** Last id_exam of the previous page, if has_after */
+    u32 has_after; /** 0 for the first page */
+    u32 limit;     /** Results in the page */
+  };
+
+  /**
+   * @brief TOP_RESULTS request
    */
-  bool _read();
+  struct TopQuery {
+    i32 stage;
+    i32 top_k;
+  };
+
+  static constexpr i32 POLL_INTERVAL_MS = 100; /** Shutdown/timeout checks */
+  static constexpr size_t READ_BUFFER_SIZE = 64 * 1024;
+  static constexpr std::string_view RESPONSE_TRAILER = "$\r\n";
+  static constexpr size_t DEFAULT_PAGE_RESULTS = 100;
+  static constexpr size_t MAX_PAGE_RESULTS = 10000;
+  /** Longest wait on the queue between two polls of the front-ends */
+  static constexpr std::chrono::milliseconds FRONTEND_POLL_INTERVAL{1};
+
+  /**
+   * @brief Wait for the next request to serve
+   * @details With several front-ends, requests relayed to the primary are
+   *          polled here and queued, and a front-end collects the replies of
+   *          its relays and learns here that the primary is shutting down.
+   *          A front-end with max_relays requests at the primary takes no
+   *          more from its queue.
+   * @return False once the queue is closed and empty, and a front-end has
+   *         the replies of all its relays
+   */
+  bool _next(PendingRequest& pending);
+
+  /**
+   * @brief Queue the requests relayed by the front-ends (primary), or answer
+   *        the relays the primary replied to and check whether it is
+   *        shutting down (other front-ends)
+   */
+  void _poll_frontends();
+
+  /**
+   * @brief Send a queued request to the primary (front-ends but rank 0)
+   * @details REVIEW and RANK exams are parsed here, store queries too, and
+   *          go in binary form; the rest as is. The request is answered and
+   *          released by _finish_relay() once the primary replies, or right
+   *          away if it does not parse.
+   */
+  void _relay(PendingRequest& pending);
+
+  /**
+   * @brief Answer the client of a relay with the reply of the primary
+   * @details Writes the JSON of the requests relayed in binary form.
+   */
+  void _finish_relay(Relay& relay, ScoreHiveResponse response);
+
+  /**
+   * @brief JSON response of a relayed REVIEW, RANK or store command
+   * @param data What the primary replied, in the binary form
+   * @return null for the commands forwarded as they are
+   */
+  static json _relayed_json(const Relay& relay, std::string_view data);
+
+  /**
+   * @brief Admit a request to the queue
+   * @return The response refusing it, none if it was admitted
+   */
+  std::optional<ScoreHiveResponse> _enqueue(PendingRequest pending);
+
+  /**
+   * @brief Handle a request of the queue and send its response
+   */
+  void _serve(PendingRequest& pending);
+
+  /**
+   * @brief Whether a request can be served with other small reviews
+   * @details Reviews read by this rank or relayed by a front-end, each of
+   *          fewer than batch_max_exams exams. A review the Scheduler may
+   *          score on the master, or any review when there are no workers,
+   *          is served at once: there is no round trip to save. Front-ends
+   *          other than the primary relay their reviews one by one.
+   */
+  bool _batches(const PendingRequest& pending) const;
+
+  /**
+   * @brief Serve a small review together with the ones that join it
+   * @details The reviews of the same priority that are queued next, or come
+   *          within batch_window_us of the admission of `first`, join it up
+   *          to batch_max_exams exams. They are scored in one round over the
+   *          workers and the results are split back to each client in order.
+   *          A review that does not parse only fails for its own client.
+   */
+  void _serve_batch(PendingRequest& first);
+
+  /**
+   * @brief Exams of a queued review
+   * @throw std::runtime_error If they do not parse
+   */
+  std::vector<MPIExam> _review_exams(const PendingRequest& pending) const;
+
+  /**
+   * @brief Send the response of a queued request to its client or front-end
+   */
+  void _respond(const PendingRequest& pending, ScoreHiveResponse response);
+
+  /**
+   * @brief Serve the queued reviews of a priority above `running`
+   * @details Scheduler preemption hook, called while a review of priority
+   *          `running` waits on the workers. Only REVIEW and RANK requests
+   *          run inside another review: SHUTDOWN or REMOVE_WORKERS would
+   *          take the workers away from the chunks it has yet to dispatch,
+   *          so every other request waits for its turn.
+   */
+  void _preempt(Priority running);
+
+  /**
+   * @brief Accept clients, read their request and admit it to the queue
+   * @details Runs on the acceptor thread until the server is shutdown and
+   *          every response is sent. Every client is read as its data
+   *          arrives, so a slow client never holds the others back in the
+   *          listen backlog, and the responses handed over by _reply() are
+   *          sent as the clients read them. When capturing, every complete
+   *          request is recorded before it is admitted, and the capture is
+   *          flushed once per poll round.
+   */
+  void _accept_loop(i32 socket_fd);
+
+  /**
+   * @brief Read the data available from the client
+   * @param message Data received so far, extended with the new data
+   * @return True once the whole request has been received
+   * @throw std::runtime_error If the read fails or the message is too large
+   */
+  bool _read(i32 client_fd, std::string& message) const;
+
+  /**
+   * @brief Parse a request and admit it to the queue
+   * @details STATUS requests are answered here, without queueing, and
+   *          requests over the queue limits get a BUSY response.
+   * @throw std::runtime_error If the request is malformed
+   */
+  void _admit(i32 client_fd, const std::string& message);
 
   /**
    * @brief Parse the request
    * @param message The message to parse
    * @details This function will parse the request and set the request fields.
    */
-  void _parse_request(const std::string& message);
+  void _parse_request(const std::string& message,
+                      ScoreHiveRequest& request) const;
 
   /**
-   * @brief Parse the response
-   * @return The response message
-   * @details This function will parse the response and set the response fields.
+   * @brief Header of the response, "SH <code> <length> "
+   * @details The body follows as is, then RESPONSE_TRAILER.
    */
-  std::string _parse_response();
+  static std::string _response_header(const ScoreHiveResponse& response);
+
+  /**
+   * @brief Send a response and close the client socket
+   * @details Never waits: what the socket does not take right away is handed
+   *          to the acceptor thread, the client then has write_timeout_ms to
+   *          read the rest.
+   */
+  void _reply(i32 client_fd, ScoreHiveResponse response);
+
+
+  /**
+   * @brief Write to a non-blocking socket what it takes without waiting
+   * @param parts Buffers to write in order, advanced as they are written
+   *              and emptied once written in full
+   * @return False if the socket failed, with errno set
+   */
+  static bool _write(i32 client_fd, std::span<iovec> parts);
+
+  /**
+   * @brief Write what the socket takes of the rest of a response
+   * @details The parts left are rebuilt from outgoing.sent on every call, so
+   *          the buffers may move along with the Outgoing.
+   * @return False if the socket failed, with errno set
+   */
+  static bool _send(i32 client_fd, Outgoing& outgoing);
+
+  /**
+   * @brief Send more of the responses the clients are reading
+   * @details Acceptor thread only. Takes the responses handed over since the
+   *          last call, drops the clients that failed or ran out of time.
+   */
+  void _send_outgoing(std::map<i32, Outgoing>& writes,
+                      std::span<const pollfd> ready);
+
+  /**
+   * @brief Depth of the request queue
+   * @param limits Also report the limits and the latency of each priority
+   */
+  json _queue_status(bool limits) const;
 
   /**
    * @brief Handle the request
@@ -79,6 +331,15 @@ class Server {
    */
   void _handle_request();
 
+  /**
+   * @brief Handle a request relayed in binary form by another front-end
+   * @details Answered in binary form too: the MPIResult records of a REVIEW,
+   *          the records and the score histogram of a RANK or TOP_RESULTS,
+   *          and the stored records of a FETCH_RESULTS or PAGE_RESULTS. The
+   *          front-end writes the JSON.
+   */
+  void _handle_relayed(const PendingRequest& pending);
+
   /**
    * @brief Handle the GET_ANSWERS request
    * @details This function will handle the GET_ANSWERS request. It will return
@@ -93,6 +354,13 @@ class Server {
    */
   void _handle_set_answers();
 
+  /**
+   * @brief Handle the PATCH_ANSWERS request
+   * @details Changes single questions of the answer keys. Reviews already
+   *          running keep scoring with the keys they started with.
+   */
+  void _handle_patch_answers();
+
   /**
    * @brief Handle the REVIEW request
    * @details This function will handle the REVIEW request. It will send the
@@ -114,6 +382,107 @@ class Server {
    */
   void _handle_shutdown();
 
+  /**
+   * @brief Handle the ADD_WORKERS request
+   * @details This function will spawn the requested number of workers and
+   *          return the number of live workers.
+   */
+  void _handle_add_workers();
+
+  /**
+   * @brief Handle the REMOVE_WORKERS request
+   * @details This function will drain and retire the requested number of
+   *          workers and return the number of live workers.
+   */
+  void _handle_remove_workers();
+
+  /**
+   * @brief Handle the ANALYTICS request
+   * @details This function will return the per-stage score summaries and the
+   *          per-question correct rates of the reviews since the answers were
+   *          last set.
+   */
+  void _handle_analytics();
+
+  /**
+   * @brief Handle the RANK request
+   * @details This function will review the exams and return them with their
+   *          rank and percentile within their stage, or only the best top_k
+   *          of each stage when requested.
+   */
+  void _handle_rank();
+
+  /**
+   * @brief Handle the FETCH_RESULTS request
+   * @details Looks the exams up in the ResultStore, the workers are not
+   *          involved.
+   */
+  void _handle_fetch_results();
+
+  /**
+   * @brief Handle the PAGE_RESULTS request
+   * @details Returns a page of the stored results of a stage, by id_exam.
+   *          Pages hold at most MAX_PAGE_RESULTS results.
+   */
+  void _handle_page_results();
+
+  /**
+   * @brief Handle the TOP_RESULTS request
+   * @details Ranks the stored results of a stage and returns the best top_k.
+   */
+  void _handle_top_results();
+
+  /**
+   * @brief Exams of a FETCH_RESULTS request
+   */
+  static std::vector<ResultKey> _fetch_keys(const std::string& data);
+
+  /**
+   * @brief PAGE_RESULTS request, its limit clamped to MAX_PAGE_RESULTS
+   */
+  static PageQuery _page_query(const std::string& data);
+
+  /**
+   * @brief TOP_RESULTS request
+   * @throws std::runtime_error if top_k is not positive
+   */
+  static TopQuery _top_query(const std::string& data);
+
+  /**
+   * @brief The ResultStore, if it is open
+   * @throws std::runtime_error if it is disabled
+   */
+  static ResultStore& _store();
+
+  /**
+   * @brief Latest stored result of each exam, none if it has none
+   */
+  static std::vector<std::optional<MPIResult>> _fetch(
+      std::span<const ResultKey> keys);
+
+  /**
+   * @brief Stored results of a page, and the first of the next one if any
+   */
+  static std::vector<MPIResult> _page(PageQuery query);
+
+  /**
+   * @brief Best stored results of a stage
+   * @param counts Score histogram of the stage
+   */
+  static std::vector<MPIResult> _top(const TopQuery& query,
+                                     std::vector<ScoreCount>& counts);
+
+  /**
+   * @brief JSON of a FETCH_RESULTS response, null for the missing results
+   */
+  static json _fetch_json(const std::vector<std::optional<MPIResult>>& found);
+
+  /**
+   * @brief JSON of a PAGE_RESULTS response
+   * @param results What _page() returned
+   */
+  static json _page_json(std::vector<MPIResult> results, u32 limit);
+
   /**
    * @brief Handle a bad request
    * @details This function will handle a bad request. It will set the response
@@ -121,12 +490,21 @@ class Server {
    */
   void _handle_bad_request();
 
-  i32 _client_socket_fd;       /** Client socket file descriptor */
-  ServerConfig _config;        /** Server configuration */
-  ScoreHiveRequest _request;   /** Request */
-  ScoreHiveResponse _response; /** Response */
-  i32 _mpi_size;               /** MPI size */
-  bool _shutdown = false;      /** Shutdown flag */
+  i32 _client_socket_fd;               /** Client socket file descriptor */
+  ServerConfig _config;                /** Server configuration */
+  ScoreHiveRequest _request;           /** Request */
+  ScoreHiveResponse _response;         /** Response */
+  RequestQueue _queue;                 /** Requests admitted by the acceptor */
+  std::atomic<bool> _shutdown = false; /** Shutdown flag */
+  /** Capture of the requests, written by the acceptor thread only */
+  std::unique_ptr<TrafficWriter> _capture;
+  /** Responses handed to the acceptor thread by _reply() */
+  std::vector<std::pair<i32, Outgoing>> _handed_over;
+  std::mutex _handed_over_mutex;
+  i32 _wake_fd = -1;                 /** Wakes the acceptor up for them */
+  std::atomic<bool> _served = false; /** The last response was handed over */
+  /** Requests relayed to the primary, by relay id (front-ends but rank 0) */
+  std::map<u64, Relay> _relays;
 };
 
 #endif  // SERVER_HPP
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "traffic_log.hpp"
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+void write_value(std::ofstream& file, T value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T read_value(std::span<const u8> data, size_t& offset) {
+  T value;
+  if (data.size() - offset < sizeof(value)) {
+    throw std::runtime_error("Truncated traffic capture");
+  }
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  offset += sizeof(value);
+  return value;
+}
+
+}  // namespace
+
+TrafficWriter::TrafficWriter(const std::string& path)
+    : _file(path, std::ios::binary | std::ios::trunc),
+      _start(std::chrono::steady_clock::now()) {
+  if (!_file) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  auto started = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+  _file.write(TRAFFIC_MAGIC, sizeof(TRAFFIC_MAGIC));
+  write_value(_file, static_cast<u64>(started));
+}
+
+void TrafficWriter::record(std::string_view message) {
+  auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - _start)
+                    .count();
+  write_value(_file, static_cast<u64>(offset));
+  write_value(_file, static_cast<u32>(message.size()));
+  _file.write(message.data(), static_cast<std::streamsize>(message.size()));
+  _records++;
+}
+
+void TrafficWriter::flush() {
+  _file.flush();
+}
+
+TrafficReader::TrafficReader(const std::string& path)
+    : _file(std::make_unique<MappedFile>(path)) {
+  auto data = _file->data();
+  if (data.size() < sizeof(TRAFFIC_MAGIC) ||
+      std::memcmp(data.data(), TRAFFIC_MAGIC, sizeof(TRAFFIC_MAGIC)) != 0) {
+    throw std::runtime_error(path + " is not a traffic capture");
+  }
+  size_t offset = sizeof(TRAFFIC_MAGIC);
+  _started_us = read_value<u64>(data, offset);
+  while (offset < data.size()) {
+    auto offset_us = read_value<u64>(data, offset);
+    auto length = read_value<u32>(data, offset);
+    if (data.size() - offset < length) {
+      throw std::runtime_error("Truncated traffic capture");
+    }
+    _records.push_back(
+        {offset_us, std::string_view(
+                        reinterpret_cast<const char*>(data.data() + offset),
+                        length)});
+    offset += length;
+  }
+}
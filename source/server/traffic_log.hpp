@@ -0,0 +1,85 @@
+#pragma once
+#ifndef TRAFFIC_LOG_HPP
+#define TRAFFIC_LOG_HPP
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system/aliases.hpp>
+#include <system/mapped_file.hpp>
+#include <vector>
+
+/**
+ * @brief Request read back from a capture
+ */
+struct TrafficRecord {
+  u64 offset_us;            /** Time since the capture started */
+  std::string_view message; /** Request as received, "SH ...$" */
+};
+
+/**
+ * @brief Capture of the requests received by the server
+ * @details Binary, in native byte order: TRAFFIC_MAGIC and the start time of
+ *          the capture (u64, microseconds since the epoch), then for every
+ *          request the time it was received (u64, microseconds since the
+ *          start) and the request itself (u32 length, then the bytes). The
+ *          requests are written in the order they were completely received,
+ *          so offsets never decrease.
+ */
+static constexpr char TRAFFIC_MAGIC[8] = {'S', 'H', 'T', 'R',
+                                          'A', 'F', '0', '1'};
+
+/**
+ * @brief Appends requests to a capture
+ * @details Not thread safe, the server records from its acceptor thread.
+ *          Records are buffered, flush() writes them out.
+ */
+class TrafficWriter {
+ public:
+  /**
+   * @brief Start a capture, the file is truncated
+   * @throws std::runtime_error if the file cannot be opened
+   */
+  explicit TrafficWriter(const std::string& path);
+
+  void record(std::string_view message);
+
+  void flush();
+
+  u64 records() const { return _records; }
+
+ private:
+  std::ofstream _file;
+  std::chrono::steady_clock::time_point _start;
+  u64 _records = 0;
+};
+
+/**
+ * @brief Reads a whole capture, memory-mapped
+ */
+class TrafficReader {
+ public:
+  /**
+   * @throws std::runtime_error if the file is not a capture or is truncated
+   */
+  explicit TrafficReader(const std::string& path);
+
+  /**
+   * @brief Start of the capture, microseconds since the epoch
+   */
+  u64 started_us() const { return _started_us; }
+
+  /**
+   * @brief Requests in capture order, they point into the mapping
+   */
+  const std::vector<TrafficRecord>& records() const { return _records; }
+
+ private:
+  std::unique_ptr<MappedFile> _file;
+  u64 _started_us = 0;
+  std::vector<TrafficRecord> _records;
+};
+
+#endif  // TRAFFIC_LOG_HPP
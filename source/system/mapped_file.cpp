@@ -0,0 +1,40 @@
+#include "mapped_file.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+
+MappedFile::MappedFile(const std::string& path) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open " + path + ": " +
+                             strerror(errno));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    close(fd);
+    throw std::runtime_error("Failed to stat " + path + ": " +
+                             strerror(errno));
+  }
+  _size = static_cast<size_t>(file_stat.st_size);
+  if (_size > 0) {
+    auto* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Failed to map " + path + ": " +
+                               strerror(errno));
+    }
+    // the file is read front to back
+    madvise(mapped, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const u8*>(mapped);
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (_data != nullptr) {
+    munmap(const_cast<u8*>(_data), _size);
+  }
+}
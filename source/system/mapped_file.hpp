@@ -0,0 +1,35 @@
+#pragma once
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <span>
+#include <string>
+#include <system/aliases.hpp>
+
+/**
+ * @brief Read-only memory mapping of a whole file
+ * @details The pages are read on demand by the kernel, so large inputs are
+ *          never copied into a buffer. The mapping is released with the object.
+ */
+class MappedFile {
+ public:
+  /**
+   * @brief Map a file
+   * @param path Path of the file
+   * @throws std::runtime_error if the file cannot be opened or mapped
+   */
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::span<const u8> data() const { return {_data, _size}; }
+
+  size_t size() const { return _size; }
+
+ private:
+  const u8* _data = nullptr;
+  size_t _size = 0;
+};
+
+#endif  // MAPPED_FILE_HPP
@@ -0,0 +1,173 @@
+#include "topology.hpp"
+#include <sched.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string_view>
+#include <tuple>
+
+namespace {
+
+constexpr std::string_view CPU_ROOT = "/sys/devices/system/cpu/cpu";
+
+i32 read_id(const std::string& path, i32 fallback) {
+  std::ifstream file(path);
+  i32 value = fallback;
+  if (!(file >> value)) {
+    return fallback;
+  }
+  return value;
+}
+
+/**
+ * @brief NUMA node of a CPU, from its "nodeN" link in sysfs
+ */
+i32 numa_node_of(i32 cpu) {
+  std::error_code error;
+  auto cpu_dir = std::string(CPU_ROOT) + std::to_string(cpu);
+  for (const auto& entry :
+       std::filesystem::directory_iterator(cpu_dir, error)) {
+    auto name = entry.path().filename().string();
+    if (name.size() > 4 && name.starts_with("node") &&
+        std::all_of(name.begin() + 4, name.end(), [](char c) {
+          return std::isdigit(static_cast<unsigned char>(c)) != 0;
+        })) {
+      return std::stoi(name.substr(4));
+    }
+  }
+  return 0;
+}
+
+std::string cpu_list(const std::vector<i32>& cpus) {
+  std::string list;
+  for (auto cpu : cpus) {
+    if (!list.empty()) {
+      list += ",";
+    }
+    list += std::to_string(cpu);
+  }
+  return list;
+}
+
+}  // namespace
+
+std::unique_ptr<Topology> Topology::_instance = nullptr;
+
+Topology& Topology::instance() {
+  static std::once_flag flag;
+  std::call_once(flag, []() { _instance.reset(new Topology()); });
+  return *_instance;
+}
+
+Topology::Topology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    spdlog::warn("Failed to read the CPU affinity, topology unknown");
+    return;
+  }
+  for (i32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) {
+      continue;
+    }
+    auto topology_dir =
+        std::string(CPU_ROOT) + std::to_string(cpu) + "/topology/";
+    auto package = read_id(topology_dir + "physical_package_id", 0);
+    // without sysfs every CPU counts as a core of its own
+    auto core_id = read_id(topology_dir + "core_id", cpu);
+    auto numa_node = numa_node_of(cpu);
+    auto it = std::find_if(_cores.begin(), _cores.end(), [&](const Core& c) {
+      return c.package == package && c.core_id == core_id;
+    });
+    if (it == _cores.end()) {
+      _cores.push_back({numa_node, package, core_id, {cpu}});
+    } else {
+      it->cpus.push_back(cpu);
+    }
+  }
+  std::sort(_cores.begin(), _cores.end(), [](const Core& a, const Core& b) {
+    return std::tie(a.numa_node, a.package, a.core_id) <
+           std::tie(b.numa_node, b.package, b.core_id);
+  });
+  for (const auto& core : _cores) {
+    if (_numa_nodes.empty() || _numa_nodes.back() != core.numa_node) {
+      _numa_nodes.push_back(core.numa_node);
+    }
+  }
+}
+
+void Topology::place_rank(PinMode mode, i32 local_rank) {
+  if (mode == PinMode::NONE || _cores.empty()) {
+    return;
+  }
+  std::vector<i32> cpus;
+  std::string where;
+  if (mode == PinMode::CORE) {
+    const auto& core = _cores[static_cast<size_t>(local_rank) % _cores.size()];
+    cpus = core.cpus;
+    where = "core " + std::to_string(core.package) + ":" +
+            std::to_string(core.core_id) + " on NUMA node " +
+            std::to_string(core.numa_node);
+    if (static_cast<size_t>(local_rank) >= _cores.size()) {
+      spdlog::warn("More ranks than cores, rank {} shares {}", local_rank,
+                   where);
+    }
+  } else {
+    auto node = _numa_nodes[static_cast<size_t>(local_rank) %
+                            _numa_nodes.size()];
+    for (const auto& core : _cores) {
+      if (core.numa_node == node) {
+        cpus.insert(cpus.end(), core.cpus.begin(), core.cpus.end());
+      }
+    }
+    where = "NUMA node " + std::to_string(node);
+  }
+  std::sort(cpus.begin(), cpus.end());
+  _main_thread = pthread_self();
+  if (!_pin(_main_thread, cpus)) {
+    spdlog::warn("Failed to pin local rank {} to {}", local_rank, where);
+    return;
+  }
+  _rank_cpus = cpus;
+  spdlog::info("Local rank {} pinned to {} (CPUs {})", local_rank, where,
+               cpu_list(cpus));
+}
+
+void Topology::place_io_thread() {
+  if (_rank_cpus.empty()) {
+    return;
+  }
+  auto main_cpus = _rank_cpus;
+  auto io_cpus = _rank_cpus;
+  if (_rank_cpus.size() > 1) {
+    main_cpus.resize(1);
+    io_cpus.erase(io_cpus.begin());
+    _pin(_main_thread, main_cpus);
+  }
+  if (_pin(pthread_self(), io_cpus)) {
+    spdlog::info("I/O thread pinned to CPUs {}, main thread to CPUs {}",
+                 cpu_list(io_cpus), cpu_list(main_cpus));
+  }
+}
+
+std::string Topology::describe() const {
+  size_t cpus = 0;
+  for (const auto& core : _cores) {
+    cpus += core.cpus.size();
+  }
+  return std::to_string(_numa_nodes.size()) + " NUMA nodes, " +
+         std::to_string(_cores.size()) + " cores, " + std::to_string(cpus) +
+         " CPUs";
+}
+
+bool Topology::_pin(pthread_t thread, const std::vector<i32>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
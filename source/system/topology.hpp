@@ -0,0 +1,80 @@
+#pragma once
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <pthread.h>
+#include <memory>
+#include <string>
+#include <system/aliases.hpp>
+#include <vector>
+
+/**
+ * @brief Where the ranks of a host are pinned
+ */
+enum class PinMode : u8 {
+  NONE = 0, /** Leave placement to the OS (and mpirun) */
+  CORE = 1, /** One physical core per rank, with its hardware threads */
+  NUMA = 2, /** One NUMA node per rank, round robin */
+};
+
+/**
+ * @brief Physical core and the CPUs (hardware threads) it runs
+ */
+struct Core {
+  i32 numa_node;
+  i32 package;
+  i32 core_id;
+  std::vector<i32> cpus;
+};
+
+/**
+ * @brief CPU topology of the host, read from Linux sysfs
+ * @details Only the CPUs the process may run on are considered, so a
+ *          container or an mpirun binding restricts the layout too; start
+ *          mpirun with --bind-to none when the ranks pin themselves. Missing
+ *          sysfs entries fall back to one NUMA node and one CPU per core.
+ *          Pinning a thread before it allocates its buffers also places them:
+ *          with the default policy Linux backs a page on the NUMA node of the
+ *          CPU that touches it first.
+ */
+class Topology {
+ public:
+  static Topology& instance();
+  ~Topology() = default;
+
+  /**
+   * @brief Pin the calling thread, the main thread of the rank
+   * @param local_rank Position of the rank among the ranks of the host
+   * @details Logs the chosen placement. Nothing is pinned with
+   *          PinMode::NONE.
+   */
+  void place_rank(PinMode mode, i32 local_rank);
+
+  /**
+   * @brief Pin the calling thread next to the main thread of the rank
+   * @details For the server I/O thread. When the rank has several CPUs they
+   *          are split: the main thread keeps the first one and the calling
+   *          thread gets the others, so polling the workers and serving
+   *          clients do not compete. No-op when the rank is not pinned.
+   */
+  void place_io_thread();
+
+  const std::vector<Core>& cores() const { return _cores; }
+
+  /**
+   * @brief One line summary, e.g. "2 NUMA nodes, 8 cores, 16 CPUs"
+   */
+  std::string describe() const;
+
+ private:
+  Topology();
+  static std::unique_ptr<Topology> _instance;
+  std::vector<Core> _cores;      /** By NUMA node, package and core id */
+  std::vector<i32> _numa_nodes;  /** Ids of the nodes with usable CPUs */
+  std::vector<i32> _rank_cpus;   /** CPUs of this rank, empty if unpinned */
+  pthread_t _main_thread{};
+
+  static bool _pin(pthread_t thread, const std::vector<i32>& cpus);
+};
+
+#endif  // TOPOLOGY_HPP